@@ -1,5 +1,15 @@
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "mpc.h"
 
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
 /*
 ** State Type
 */
@@ -272,6 +282,196 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
   return y;
 }
 
+/*
+** Lazy Error Type
+**
+** Most errors made during a parse are thrown away
+** again, either because another alternative worked
+** or because the whole parse did. So rather than
+** building an `mpc_err_t` for every one, the parse
+** records a small node that borrows its message
+** from the parser, and `mpc_err_t`s are only built
+** from these if the parse fails in the end.
+**
+** Nodes come from a per-thread free list, so once
+** that has warmed up a parse that succeeds doesn't
+** allocate anything for errors at all.
+*/
+
+enum {
+  MPC_LERR_EXPECTED,
+  MPC_LERR_FAILURE,
+  MPC_LERR_OR,
+  MPC_LERR_REPEAT,
+  MPC_LERR_SKIPPED
+};
+
+typedef struct mpc_lerr_t {
+  char type;
+  char recieved;
+  int n;
+  mpc_state_t state;
+  const char *m;
+  mpc_parser_t *p;
+  struct mpc_lerr_t *child;
+  struct mpc_lerr_t *next;
+} mpc_lerr_t;
+
+typedef union {
+  mpc_lerr_t *error;
+  mpc_val_t *output;
+} mpc_sresult_t;
+
+static _Thread_local mpc_lerr_t *mpc_lerr_pool = NULL;
+
+static mpc_lerr_t *mpc_lerr_new(int type, mpc_state_t s, const char *m, char recieved) {
+  mpc_lerr_t *x = mpc_lerr_pool;
+  if (x) { mpc_lerr_pool = x->next; } else { x = malloc(sizeof(mpc_lerr_t)); }
+  x->type = type;
+  x->recieved = recieved;
+  x->n = 0;
+  x->state = s;
+  x->m = m;
+  x->p = NULL;
+  x->child = NULL;
+  x->next = NULL;
+  return x;
+}
+
+static mpc_lerr_t *mpc_lerr_expected(mpc_state_t s, const char *expected, char recieved) {
+  return mpc_lerr_new(MPC_LERR_EXPECTED, s, expected, recieved);
+}
+
+static mpc_lerr_t *mpc_lerr_failure(mpc_state_t s, const char *failure) {
+  return mpc_lerr_new(MPC_LERR_FAILURE, s, failure, ' ');
+}
+
+/* `n` is the count for `mpc_count`, or 0 for `mpc_many1` */
+static mpc_lerr_t *mpc_lerr_repeat(mpc_lerr_t *x, int n) {
+  mpc_lerr_t *e = mpc_lerr_new(MPC_LERR_REPEAT, x->state, NULL, x->recieved);
+  e->n = n;
+  e->child = x;
+  return e;
+}
+
+/* An `or` alternative that was never tried, see `mpc_predict` */
+static mpc_lerr_t *mpc_lerr_skipped(mpc_parser_t *p, mpc_state_t s, char recieved) {
+  mpc_lerr_t *e = mpc_lerr_new(MPC_LERR_SKIPPED, s, NULL, recieved);
+  e->p = p;
+  return e;
+}
+
+static mpc_lerr_t *mpc_lerr_or(mpc_lerr_t **xs, int n) {
+  int i;
+  mpc_lerr_t *e = mpc_lerr_new(MPC_LERR_OR, xs[0]->state, NULL, ' ');
+  for (i = n-1; i >= 0; i--) {
+    if (xs[i]->state.pos >= e->state.pos) { e->state = xs[i]->state; }
+    xs[i]->next = e->child;
+    e->child = xs[i];
+  }
+  return e;
+}
+
+static void mpc_lerr_delete(mpc_lerr_t *x) {
+  mpc_lerr_t *c = x->child, *next;
+  while (c) {
+    next = c->next;
+    mpc_lerr_delete(c);
+    c = next;
+  }
+  x->next = mpc_lerr_pool;
+  mpc_lerr_pool = x;
+}
+
+static mpc_lerr_t *mpc_lerr_copy(mpc_lerr_t *x) {
+  mpc_lerr_t *e = mpc_lerr_new(x->type, x->state, x->m, x->recieved);
+  mpc_lerr_t *c, **tail = &e->child;
+  e->n = x->n;
+  e->p = x->p;
+  for (c = x->child; c; c = c->next) {
+    *tail = mpc_lerr_copy(c);
+    tail = &(*tail)->next;
+  }
+  return e;
+}
+
+static mpc_err_t *mpc_first_err(const char *filename, mpc_parser_t *p, mpc_state_t s, char recieved);
+
+/* Builds the `mpc_err_t` the parse used to build eagerly */
+static mpc_err_t *mpc_lerr_build(const char *filename, mpc_lerr_t *x) {
+  
+  int n = 0;
+  mpc_lerr_t *c;
+  mpc_err_t **xs, *e;
+  
+  switch (x->type) {
+    case MPC_LERR_EXPECTED: return mpc_err_new(filename, x->state, x->m, x->recieved);
+    case MPC_LERR_FAILURE: return mpc_err_fail(filename, x->state, x->m);
+    case MPC_LERR_REPEAT:
+      e = mpc_lerr_build(filename, x->child);
+      return x->n == 0 ? mpc_err_many1(e) : mpc_err_count(e, x->n);
+    case MPC_LERR_SKIPPED: return mpc_first_err(filename, x->p, x->state, x->recieved);
+    default: break;
+  }
+  
+  for (c = x->child; c; c = c->next) { n++; }
+  xs = malloc(sizeof(mpc_err_t*) * n);
+  n = 0;
+  for (c = x->child; c; c = c->next) { xs[n++] = mpc_lerr_build(filename, c); }
+  e = mpc_err_or(xs, n);
+  free(xs);
+  return e;
+}
+
+/*
+** Character Set Type
+**
+** Sets of characters are kept as a bitmap with
+** one bit for each byte value, so testing if a
+** character is in the set is a single lookup no
+** matter how big the set is. They are built once
+** when the parser is made. The null byte is never
+** a member.
+*/
+
+typedef unsigned char mpc_charset_t[32];
+
+static int mpc_charset_has(const unsigned char *set, char c) {
+  unsigned char u = (unsigned char)c;
+  return (set[u / 8] >> (u % 8)) & 1;
+}
+
+static void mpc_charset_add(unsigned char *set, char c) {
+  unsigned char u = (unsigned char)c;
+  if (u != 0) { set[u / 8] |= 1 << (u % 8); }
+}
+
+static void mpc_charset_add_str(unsigned char *set, const char *s) {
+  while (*s) { mpc_charset_add(set, *s++); }
+}
+
+static void mpc_charset_invert(unsigned char *set) {
+  int i;
+  for (i = 0; i < 32; i++) { set[i] = ~set[i]; }
+  set[0] &= ~1;
+}
+
+static int mpc_charset_size(const unsigned char *set) {
+  int c, n = 0;
+  for (c = 1; c < 256; c++) { n += mpc_charset_has(set, c); }
+  return n;
+}
+
+static char *mpc_charset_chars(const unsigned char *set) {
+  int c, n = 0;
+  char *s = malloc(mpc_charset_size(set) + 1);
+  for (c = 1; c < 256; c++) {
+    if (mpc_charset_has(set, c)) { s[n++] = c; }
+  }
+  s[n] = '\0';
+  return s;
+}
+
 /*
 ** Input Type
 */
@@ -301,6 +501,13 @@ static mpc_err_t *mpc_err_count(mpc_err_t *x, int n) {
 ** back we can simply start reading from the
 ** buffer instead of the input.
 **
+** Files named by `mpc_parse_contents` skip all
+** of that where they can. A regular file is mapped
+** into memory and then read as a String, straight
+** out of the mapping, with no copy and no calls
+** to the system per character. Other files are
+** read as a Pipe, since they may not seek.
+**
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
@@ -320,7 +527,12 @@ typedef struct {
   mpc_state_t state;
   
   char *string;
+  long length;
+  int mapped;
   char *buffer;
+  long buffer_pos;
+  long buffer_len;
+  long buffer_max;
   FILE *file;
   
   int backtrack;
@@ -342,9 +554,14 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
   
   i->state = mpc_state_new();
   
-  i->string = malloc(strlen(string) + 1);
+  i->length = strlen(string);
+  i->string = malloc(i->length + 1);
   strcpy(i->string, string);
+  i->mapped = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_len = 0;
+  i->buffer_max = 0;
   i->file = NULL;
   
   i->backtrack = 1;
@@ -368,7 +585,12 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
+  i->mapped = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_len = 0;
+  i->buffer_max = 0;
   i->file = pipe;
   
   i->backtrack = 1;
@@ -392,7 +614,12 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   i->state = mpc_state_new();
   
   i->string = NULL;
+  i->length = 0;
+  i->mapped = 0;
   i->buffer = NULL;
+  i->buffer_pos = 0;
+  i->buffer_len = 0;
+  i->buffer_max = 0;
   i->file = file;
   
   i->backtrack = 1;
@@ -405,11 +632,52 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file) {
   return i;
 }
 
+/*
+** Picks an input for a whole named file. A regular
+** file is mapped into memory as a String. Anything
+** else might not seek, so it is read as a Pipe. A
+** file that won't map is read as a File and an
+** empty one is just an empty string.
+*/
+
+static mpc_input_t *mpc_input_new_contents(const char *filename, FILE *file) {
+  
+#ifndef _WIN32
+  
+  mpc_input_t *i;
+  struct stat sb;
+  void *m;
+  
+  if (fstat(fileno(file), &sb) != 0) { return mpc_input_new_file(filename, file); }
+  if (!S_ISREG(sb.st_mode)) { return mpc_input_new_pipe(filename, file); }
+  if (sb.st_size == 0) { return mpc_input_new_string(filename, ""); }
+  
+  m = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+  if (m == MAP_FAILED) { return mpc_input_new_file(filename, file); }
+  
+  i = mpc_input_new_string(filename, "");
+  free(i->string);
+  i->string = m;
+  i->length = sb.st_size;
+  i->mapped = 1;
+  return i;
+  
+#else
+  
+  return mpc_input_new_file(filename, file);
+  
+#endif
+  
+}
+
 static void mpc_input_delete(mpc_input_t *i) {
   
   free(i->filename);
   
-  if (i->type == MPC_INPUT_STRING) { free(i->string); }
+#ifndef _WIN32
+  if (i->type == MPC_INPUT_STRING && i->mapped) { munmap(i->string, i->length); }
+#endif
+  if (i->type == MPC_INPUT_STRING && !i->mapped) { free(i->string); }
   if (i->type == MPC_INPUT_PIPE) { free(i->buffer); }
   
   free(i->marks);
@@ -420,6 +688,45 @@ static void mpc_input_delete(mpc_input_t *i) {
 static void mpc_input_backtrack_disable(mpc_input_t *i) { i->backtrack--; }
 static void mpc_input_backtrack_enable(mpc_input_t *i) { i->backtrack++; }
 
+/*
+** While a Pipe is marked, everything read from it
+** is kept in the buffer, which starts at stream
+** position `buffer_pos`. Reads come out of the
+** buffer whenever the cursor is inside it, even
+** after the last mark has gone, since a rewind
+** can leave the cursor behind what the pipe has
+** already given us. The buffer keeps its length
+** and grows by doubling, and whatever is behind
+** the cursor is dropped when a fresh outermost
+** mark is made.
+*/
+
+static int mpc_input_buffer_in_range(mpc_input_t *i) {
+  return i->state.pos >= i->buffer_pos && i->state.pos < i->buffer_pos + i->buffer_len;
+}
+
+static char mpc_input_buffer_get(mpc_input_t *i) {
+  return i->buffer[i->state.pos - i->buffer_pos];
+}
+
+static void mpc_input_buffer_push(mpc_input_t *i, char c) {
+  if (i->buffer_len == i->buffer_max) {
+    i->buffer_max = i->buffer_max ? i->buffer_max * 2 : 64;
+    i->buffer = realloc(i->buffer, i->buffer_max);
+  }
+  i->buffer[i->buffer_len++] = c;
+}
+
+static void mpc_input_buffer_drop(mpc_input_t *i) {
+  long keep = 0;
+  if (mpc_input_buffer_in_range(i)) {
+    keep = i->buffer_pos + i->buffer_len - i->state.pos;
+    memmove(i->buffer, i->buffer + (i->state.pos - i->buffer_pos), keep);
+  }
+  i->buffer_pos = i->state.pos;
+  i->buffer_len = keep;
+}
+
 static void mpc_input_mark(mpc_input_t *i) {
   
   if (i->backtrack < 1) { return; }
@@ -431,7 +738,7 @@ static void mpc_input_mark(mpc_input_t *i) {
   i->lasts[i->marks_num-1] = i->last;
   
   if (i->type == MPC_INPUT_PIPE && i->marks_num == 1) {
-    i->buffer = calloc(1, 1);
+    mpc_input_buffer_drop(i);
   }
   
 }
@@ -444,11 +751,6 @@ static void mpc_input_unmark(mpc_input_t *i) {
   i->marks = realloc(i->marks, sizeof(mpc_state_t) * i->marks_num);
   i->lasts = realloc(i->lasts, sizeof(char) * i->marks_num);
   
-  if (i->type == MPC_INPUT_PIPE && i->marks_num == 0) {
-    free(i->buffer);
-    i->buffer = NULL;
-  }
-  
 }
 
 static void mpc_input_rewind(mpc_input_t *i) {
@@ -465,18 +767,10 @@ static void mpc_input_rewind(mpc_input_t *i) {
   mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i) {
-  return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
-static char mpc_input_buffer_get(mpc_input_t *i) {
-  return i->buffer[i->state.pos - i->marks[0].pos];
-}
-
 static int mpc_input_terminated(mpc_input_t *i) {
-  if (i->type == MPC_INPUT_STRING && i->state.pos == (long)strlen(i->string)) { return 1; }
+  if (i->type == MPC_INPUT_STRING && i->state.pos == i->length) { return 1; }
   if (i->type == MPC_INPUT_FILE && feof(i->file)) { return 1; }
-  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return 1; }
+  if (i->type == MPC_INPUT_PIPE && feof(i->file)) { return !mpc_input_buffer_in_range(i); }
   return 0;
 }
 
@@ -486,13 +780,11 @@ static char mpc_input_getc(mpc_input_t *i) {
   
   switch (i->type) {
     
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: c = fgetc(i->file); return c;
     case MPC_INPUT_PIPE:
     
-      if (!i->buffer) { c = getc(i->file); return c; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         c = mpc_input_buffer_get(i);
         return c;
       } else {
@@ -509,7 +801,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
   char c = '\0';
   
   switch (i->type) {
-    case MPC_INPUT_STRING: return i->string[i->state.pos];
+    case MPC_INPUT_STRING: return i->state.pos < i->length ? i->string[i->state.pos] : '\0';
     case MPC_INPUT_FILE: 
       
       c = fgetc(i->file);
@@ -520,14 +812,7 @@ static char mpc_input_peekc(mpc_input_t *i) {
     
     case MPC_INPUT_PIPE:
       
-      if (!i->buffer) {
-        c = getc(i->file);
-        if (feof(i->file)) { return '\0'; }
-        ungetc(c, i->file);
-        return c;
-      }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         return mpc_input_buffer_get(i);
       } else {
         c = getc(i->file);
@@ -548,9 +833,7 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
     case MPC_INPUT_FILE: fseek(i->file, -1, SEEK_CUR); { break; }
     case MPC_INPUT_PIPE: {
       
-      if (!i->buffer) { ungetc(c, i->file); break; }
-      
-      if (i->buffer && mpc_input_buffer_in_range(i)) {
+      if (mpc_input_buffer_in_range(i)) {
         break;
       } else {
         ungetc(c, i->file); 
@@ -564,12 +847,9 @@ static int mpc_input_failure(mpc_input_t *i, char c) {
 static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   
   if (i->type == MPC_INPUT_PIPE &&
-      i->buffer &&
+      i->marks_num > 0 &&
       !mpc_input_buffer_in_range(i)) {
-    
-    i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-    i->buffer[strlen(i->buffer) + 1] = '\0';
-    i->buffer[strlen(i->buffer) + 0] = c;
+    mpc_input_buffer_push(i, c);
   }
   
   i->last = c;
@@ -590,6 +870,59 @@ static int mpc_input_success(mpc_input_t *i, char c, char **o) {
   return 1;
 }
 
+/*
+** Tokens
+**
+** Primitives that match many characters at once
+** keep what they matched as a span of the input.
+** For a string input the characters are already
+** sitting in memory, so nothing is copied until
+** the match is over, and then only once. Other
+** inputs can't be read back like that so they
+** collect the characters as they go.
+*/
+
+typedef struct {
+  long start;
+  long len;
+  long max;
+  char *buf;
+} mpc_token_t;
+
+static void mpc_token_init(mpc_input_t *i, mpc_token_t *t) {
+  t->start = i->state.pos;
+  t->len = 0;
+  t->max = 0;
+  t->buf = NULL;
+}
+
+static void mpc_token_push(mpc_input_t *i, mpc_token_t *t, char c) {
+  if (i->type != MPC_INPUT_STRING) {
+    if (t->len + 1 >= t->max) {
+      t->max = t->max ? t->max * 2 : 16;
+      t->buf = realloc(t->buf, t->max);
+    }
+    t->buf[t->len] = c;
+  }
+  t->len++;
+}
+
+static char mpc_token_get(mpc_input_t *i, mpc_token_t *t, long k) {
+  return i->type == MPC_INPUT_STRING ? i->string[t->start + k] : t->buf[k];
+}
+
+static char *mpc_token_out(mpc_input_t *i, mpc_token_t *t, long len) {
+  char *o;
+  if (i->type == MPC_INPUT_STRING) {
+    o = malloc(len + 1);
+    memcpy(o, i->string + t->start, len);
+  } else {
+    o = realloc(t->buf, len + 1);
+  }
+  o[len] = '\0';
+  return o;
+}
+
 static int mpc_input_any(mpc_input_t *i, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
@@ -608,16 +941,35 @@ static int mpc_input_range(mpc_input_t *i, char c, char d, char **o) {
   return x >= c && x <= d ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_oneof(mpc_input_t *i, const char *c, char **o) {
+static int mpc_input_set(mpc_input_t *i, const unsigned char *set, char **o) {
   char x = mpc_input_getc(i);
   if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) != 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+  return mpc_charset_has(set, x) ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
 }
 
-static int mpc_input_noneof(mpc_input_t *i, const char *c, char **o) {
-  char x = mpc_input_getc(i);
-  if (mpc_input_terminated(i)) { return 0; }
-  return strchr(c, x) == 0 ? mpc_input_success(i, x, o) : mpc_input_failure(i, x);  
+/*
+** Reads as long a run of characters from the set
+** as it can, into one string, and returns how
+** many it read. It never gives any back so it
+** needs no mark.
+*/
+
+static long mpc_input_span(mpc_input_t *i, const unsigned char *set, char **o) {
+  
+  char x;
+  mpc_token_t t;
+  mpc_token_init(i, &t);
+  
+  while (1) {
+    x = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { break; }
+    if (!mpc_charset_has(set, x)) { mpc_input_failure(i, x); break; }
+    mpc_input_success(i, x, NULL);
+    mpc_token_push(i, &t, x);
+  }
+  
+  *o = mpc_token_out(i, &t, t.len);
+  return t.len;
 }
 
 static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
@@ -628,14 +980,11 @@ static int mpc_input_satisfy(mpc_input_t *i, int(*cond)(char), char **o) {
 
 static int mpc_input_string(mpc_input_t *i, const char *c, char **o) {
   
-  char *co = NULL;
   const char *x = c;
 
   mpc_input_mark(i);
   while (*x) {
-    if (mpc_input_char(i, *x, &co)) {
-      free(co);
-    } else {
+    if (!mpc_input_char(i, *x, NULL)) {
       mpc_input_rewind(i);
       return 0;
     }
@@ -652,6 +1001,57 @@ static int mpc_input_anchor(mpc_input_t* i, int(*f)(char,char)) {
   return f(i->last, mpc_input_peekc(i));
 }
 
+/*
+** Runs a compiled regex. The table is stepped
+** until no transition is left, remembering the
+** last accepting length. If the run went past
+** that we rewind and step forward again, which
+** only happens when a token's tail didn't pan out.
+*/
+
+static int mpc_input_dfa(mpc_input_t *i, int n, short *trans, char *accept, char **expected, char **o, mpc_lerr_t **e) {
+  
+  int st = 0, next;
+  long acc = accept[0] ? 0 : -1, k;
+  char c = '\0';
+  mpc_token_t t;
+  (void) n;
+  
+  mpc_token_init(i, &t);
+  mpc_input_mark(i);
+  
+  while (1) {
+    c = mpc_input_getc(i);
+    if (mpc_input_terminated(i)) { c = '\0'; break; }
+    next = trans[st * 256 + (unsigned char)c];
+    if (next < 0) { mpc_input_failure(i, c); break; }
+    mpc_input_success(i, c, NULL);
+    mpc_token_push(i, &t, c);
+    st = next;
+    if (accept[st]) { acc = t.len; }
+  }
+  
+  if (acc < 0) {
+    *e = mpc_lerr_expected(i->state, expected[st], c);
+    mpc_input_rewind(i);
+    free(t.buf);
+    return 0;
+  }
+  
+  if (acc < t.len && i->backtrack > 0) {
+    mpc_input_rewind(i);
+    for (k = 0; k < acc; k++) {
+      mpc_input_getc(i);
+      mpc_input_success(i, mpc_token_get(i, &t, k), NULL);
+    }
+  } else {
+    mpc_input_unmark(i);
+  }
+  
+  *o = mpc_token_out(i, &t, acc);
+  return 1;
+}
+
 /*
 ** Parser Type
 */
@@ -668,8 +1068,8 @@ enum {
   
   MPC_TYPE_ANY       = 8,
   MPC_TYPE_SINGLE    = 9,
-  MPC_TYPE_ONEOF     = 10,
-  MPC_TYPE_NONEOF    = 11,
+  MPC_TYPE_SET       = 10,
+  MPC_TYPE_SPAN      = 11,
   MPC_TYPE_RANGE     = 12,
   MPC_TYPE_SATISFY   = 13,
   MPC_TYPE_STRING    = 14,
@@ -684,7 +1084,10 @@ enum {
   MPC_TYPE_COUNT     = 22,
   
   MPC_TYPE_OR        = 23,
-  MPC_TYPE_AND       = 24
+  MPC_TYPE_AND       = 24,
+  
+  MPC_TYPE_MEMO      = 25,
+  MPC_TYPE_DFA       = 26
 };
 
 typedef struct { char *m; } mpc_pdata_fail_t;
@@ -695,13 +1098,17 @@ typedef struct { char x; } mpc_pdata_single_t;
 typedef struct { char x; char y; } mpc_pdata_range_t;
 typedef struct { int(*f)(char); } mpc_pdata_satisfy_t;
 typedef struct { char *x; } mpc_pdata_string_t;
+typedef struct { mpc_charset_t x; } mpc_pdata_set_t;
+typedef struct { mpc_charset_t x; int min; char *m; } mpc_pdata_span_t;
 typedef struct { mpc_parser_t *x; mpc_apply_t f; } mpc_pdata_apply_t;
 typedef struct { mpc_parser_t *x; mpc_apply_to_t f; void *d; } mpc_pdata_apply_to_t;
 typedef struct { mpc_parser_t *x; } mpc_pdata_predict_t;
 typedef struct { mpc_parser_t *x; mpc_dtor_t dx; mpc_ctor_t lf; } mpc_pdata_not_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t *x; mpc_dtor_t dx; } mpc_pdata_repeat_t;
-typedef struct { int n; mpc_parser_t **xs; } mpc_pdata_or_t;
+typedef struct { int n; mpc_parser_t **xs; long gen; mpc_charset_t *firsts; } mpc_pdata_or_t;
 typedef struct { int n; mpc_fold_t f; mpc_parser_t **xs; mpc_dtor_t *dxs;  } mpc_pdata_and_t;
+typedef struct { mpc_parser_t *x; mpc_copy_t cp; mpc_dtor_t dx; } mpc_pdata_memo_t;
+typedef struct { char *re; int n; short *trans; char *accept; char **expected; } mpc_pdata_dfa_t;
 
 typedef union {
   mpc_pdata_fail_t fail;
@@ -712,6 +1119,8 @@ typedef union {
   mpc_pdata_range_t range;
   mpc_pdata_satisfy_t satisfy;
   mpc_pdata_string_t string;
+  mpc_pdata_set_t set;
+  mpc_pdata_span_t span;
   mpc_pdata_apply_t apply;
   mpc_pdata_apply_to_t apply_to;
   mpc_pdata_predict_t predict;
@@ -719,6 +1128,8 @@ typedef union {
   mpc_pdata_repeat_t repeat;
   mpc_pdata_and_t and;
   mpc_pdata_or_t or;
+  mpc_pdata_memo_t memo;
+  mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t {
@@ -729,10 +1140,63 @@ struct mpc_parser_t {
 };
 
 /*
-** Stack Type
+** Memo Type
+**
+** Packrat parsing just means remembering what
+** each memoized parser did at each position, so
+** that when an `or` backtracks and tries another
+** alternative starting with the same rule, the
+** rule is answered from the table rather than
+** parsed all over again.
+**
+** The table is a fixed number of slots, indexed
+** by a hash of the parser and the position. A
+** collision simply evicts the older entry, so the
+** memory used stays bounded no matter how long
+** the input is. Entries hold their own copy of
+** the result, which is copied out again on a hit.
 */
 
+#ifndef MPC_MEMO_SLOTS
+#define MPC_MEMO_SLOTS 4096
+#endif
+
 typedef struct {
+  mpc_parser_t *p;
+  long pos;
+  int success;
+  mpc_sresult_t result;
+  mpc_state_t state;
+  char last;
+} mpc_memo_t;
+
+static void mpc_memo_clear(mpc_memo_t *m) {
+  if (m->p == NULL) { return; }
+  if (m->success) {
+    m->p->data.memo.dx(m->result.output);
+  } else {
+    mpc_lerr_delete(m->result.error);
+  }
+  m->p = NULL;
+}
+
+/*
+** Stack Type
+**
+** The stacks only ever grow by doubling and are
+** never shrunk during a parse. Once a parse is
+** over its stack goes onto a per-thread pool to
+** be picked up, already grown, by the next one.
+** A fold can start a parse of its own (`mpc_re`
+** does) so the pool can hold more than one.
+**
+** Errors that are set aside rather than returned,
+** when a `many` stops or a `maybe` doesn't match,
+** only matter if nothing gets further. So the stack
+** just keeps those at the furthest position seen.
+*/
+
+typedef struct mpc_stack_t {
 
   int parsers_num;
   int parsers_slots;
@@ -741,36 +1205,103 @@ typedef struct {
 
   int results_num;
   int results_slots;
-  mpc_result_t *results;
+  mpc_sresult_t *results;
   int *returns;
   
-  mpc_err_t *err;
+  const char *filename;
+  mpc_lerr_t *errs;
+  mpc_lerr_t *errs_last;
+  
+  mpc_memo_t *memo;
+  int starts_num;
+  int starts_slots;
+  long *starts;
+  
+  struct mpc_stack_t *next;
   
 } mpc_stack_t;
 
+static _Thread_local mpc_stack_t *mpc_stack_pool = NULL;
+
 static mpc_stack_t *mpc_stack_new(const char *filename) {
-  mpc_stack_t *s = malloc(sizeof(mpc_stack_t));
+  mpc_stack_t *s = mpc_stack_pool;
   
-  s->parsers_num = 0;
-  s->parsers_slots = 0;
-  s->parsers = NULL;
-  s->states = NULL;
+  if (s) {
+    mpc_stack_pool = s->next;
+  } else {
+    s = malloc(sizeof(mpc_stack_t));
+    s->parsers_slots = 0;
+    s->parsers = NULL;
+    s->states = NULL;
+    s->results_slots = 0;
+    s->results = NULL;
+    s->returns = NULL;
+    s->starts_slots = 0;
+    s->starts = NULL;
+  }
   
+  s->parsers_num = 0;
   s->results_num = 0;
-  s->results_slots = 0;
-  s->results = NULL;
-  s->returns = NULL;
+  s->starts_num = 0;
+  s->memo = NULL;
+  s->next = NULL;
   
-  s->err = mpc_err_fail(filename, mpc_state_invalid(), "Unknown Error");
+  s->filename = filename;
+  s->errs = NULL;
+  s->errs_last = NULL;
   
   return s;
 }
 
-static void mpc_stack_err(mpc_stack_t *s, mpc_err_t* e) {
-  mpc_err_t *errs[2];
-  errs[0] = s->err;
-  errs[1] = e;
-  s->err = mpc_err_or(errs, 2);
+static void mpc_stack_errs_clear(mpc_stack_t *s) {
+  mpc_lerr_t *x = s->errs, *next;
+  while (x) {
+    next = x->next;
+    mpc_lerr_delete(x);
+    x = next;
+  }
+  s->errs = NULL;
+  s->errs_last = NULL;
+}
+
+static void mpc_stack_err(mpc_stack_t *s, mpc_lerr_t *e) {
+  
+  if (s->errs && e->state.pos < s->errs->state.pos) {
+    mpc_lerr_delete(e);
+    return;
+  }
+  
+  if (s->errs && e->state.pos > s->errs->state.pos) {
+    mpc_stack_errs_clear(s);
+  }
+  
+  e->next = NULL;
+  if (s->errs) { s->errs_last->next = e; } else { s->errs = e; }
+  s->errs_last = e;
+}
+
+/*
+** Merging errors one after the other the way the
+** parse once did comes to the same thing as one
+** `mpc_err_or` over all of them, in order.
+*/
+
+static mpc_err_t *mpc_stack_err_build(mpc_stack_t *s) {
+  
+  int n = 1;
+  mpc_lerr_t *x;
+  mpc_err_t **xs, *e;
+  
+  for (x = s->errs; x; x = x->next) { n++; }
+  xs = malloc(sizeof(mpc_err_t*) * n);
+  
+  n = 0;
+  xs[n++] = mpc_err_fail(s->filename, mpc_state_invalid(), "Unknown Error");
+  for (x = s->errs; x; x = x->next) { xs[n++] = mpc_lerr_build(s->filename, x); }
+  
+  e = mpc_err_or(xs, n);
+  free(xs);
+  return e;
 }
 
 static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
@@ -778,17 +1309,20 @@ static int mpc_stack_terminate(mpc_stack_t *s, mpc_result_t *r) {
   
   if (success) {
     r->output = s->results[0].output;
-    mpc_err_delete(s->err);
   } else {
     mpc_stack_err(s, s->results[0].error);
-    r->error = s->err;
+    r->error = mpc_stack_err_build(s);
   }
+  mpc_stack_errs_clear(s);
   
-  free(s->parsers);
-  free(s->states);
-  free(s->results);
-  free(s->returns);
-  free(s);
+  if (s->memo) {
+    int i;
+    for (i = 0; i < MPC_MEMO_SLOTS; i++) { mpc_memo_clear(&s->memo[i]); }
+    free(s->memo);
+  }
+  
+  s->next = mpc_stack_pool;
+  mpc_stack_pool = s;
   
   return success;
 }
@@ -801,15 +1335,7 @@ static void mpc_stack_set_state(mpc_stack_t *s, int x) {
 
 static void mpc_stack_parsers_reserve_more(mpc_stack_t *s) {
   if (s->parsers_num > s->parsers_slots) {
-    s->parsers_slots = ceil((s->parsers_slots+1) * 1.5);
-    s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
-    s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
-  }
-}
-
-static void mpc_stack_parsers_reserve_less(mpc_stack_t *s) {
-  if (s->parsers_slots > pow(s->parsers_num+1, 1.5)) {
-    s->parsers_slots = floor((s->parsers_slots-1) * (1.0/1.5));
+    s->parsers_slots = s->parsers_slots ? s->parsers_slots * 2 : 64;
     s->parsers = realloc(s->parsers, sizeof(mpc_parser_t*) * s->parsers_slots);
     s->states = realloc(s->states, sizeof(int) * s->parsers_slots);
   }
@@ -826,7 +1352,6 @@ static void mpc_stack_popp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
   *p = s->parsers[s->parsers_num-1];
   *st = s->states[s->parsers_num-1];
   s->parsers_num--;
-  mpc_stack_parsers_reserve_less(s);
 }
 
 static void mpc_stack_peepp(mpc_stack_t *s, mpc_parser_t **p, int *st) {
@@ -840,57 +1365,48 @@ static int mpc_stack_empty(mpc_stack_t *s) {
 
 /* Stack Result Stuff */
 
-static mpc_result_t mpc_result_err(mpc_err_t *e) {
-  mpc_result_t r;
+static mpc_sresult_t mpc_result_err(mpc_lerr_t *e) {
+  mpc_sresult_t r;
   r.error = e;
   return r;
 }
 
-static mpc_result_t mpc_result_out(mpc_val_t *x) {
-  mpc_result_t r;
+static mpc_sresult_t mpc_result_out(mpc_val_t *x) {
+  mpc_sresult_t r;
   r.output = x;
   return r;
 }
 
 static void mpc_stack_results_reserve_more(mpc_stack_t *s) {
   if (s->results_num > s->results_slots) {
-    s->results_slots = ceil((s->results_slots + 1) * 1.5);
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
-    s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
-  }
-}
-
-static void mpc_stack_results_reserve_less(mpc_stack_t *s) {
-  if ( s->results_slots > pow(s->results_num+1, 1.5)) {
-    s->results_slots = floor((s->results_slots-1) * (1.0/1.5));
-    s->results = realloc(s->results, sizeof(mpc_result_t) * s->results_slots);
+    s->results_slots = s->results_slots ? s->results_slots * 2 : 64;
+    s->results = realloc(s->results, sizeof(mpc_sresult_t) * s->results_slots);
     s->returns = realloc(s->returns, sizeof(int) * s->results_slots);
   }
 }
 
-static void mpc_stack_pushr(mpc_stack_t *s, mpc_result_t x, int r) {
+static void mpc_stack_pushr(mpc_stack_t *s, mpc_sresult_t x, int r) {
   s->results_num++;
   mpc_stack_results_reserve_more(s);
   s->results[s->results_num-1] = x;
   s->returns[s->results_num-1] = r;
 }
 
-static int mpc_stack_popr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_popr(mpc_stack_t *s, mpc_sresult_t *x) {
   int r;
   *x = s->results[s->results_num-1];
   r = s->returns[s->results_num-1];
   s->results_num--;
-  mpc_stack_results_reserve_less(s);
   return r;
 }
 
-static int mpc_stack_peekr(mpc_stack_t *s, mpc_result_t *x) {
+static int mpc_stack_peekr(mpc_stack_t *s, mpc_sresult_t *x) {
   *x = s->results[s->results_num-1];
   return s->returns[s->results_num-1];
 }
 
 static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
-  mpc_result_t x;
+  mpc_sresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     mpc_stack_err(s, x.error);
@@ -899,7 +1415,7 @@ static void mpc_stack_popr_err(mpc_stack_t *s, int n) {
 }
 
 static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
-  mpc_result_t x;
+  mpc_sresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     ds[n-1](x.output);
@@ -908,7 +1424,7 @@ static void mpc_stack_popr_out(mpc_stack_t *s, int n, mpc_dtor_t *ds) {
 }
 
 static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
-  mpc_result_t x;
+  mpc_sresult_t x;
   while (n) {
     mpc_stack_popr(s, &x);
     dx(x.output);
@@ -916,24 +1432,278 @@ static void mpc_stack_popr_out_single(mpc_stack_t *s, int n, mpc_dtor_t dx) {
   }
 }
 
-static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
-  mpc_result_t x;
-  while (n) {
-    mpc_stack_popr(s, &x);
-    n--;
+static void mpc_stack_popr_n(mpc_stack_t *s, int n) {
+  mpc_sresult_t x;
+  while (n) {
+    mpc_stack_popr(s, &x);
+    n--;
+  }
+}
+
+/* Stack Memo Stuff */
+
+static mpc_memo_t *mpc_stack_memo(mpc_stack_t *s, mpc_parser_t *p, long pos) {
+  unsigned long h = ((unsigned long)p >> 4) ^ ((unsigned long)pos * 2654435761UL);
+  if (s->memo == NULL) { s->memo = calloc(MPC_MEMO_SLOTS, sizeof(mpc_memo_t)); }
+  return &s->memo[h % MPC_MEMO_SLOTS];
+}
+
+static void mpc_stack_pushs(mpc_stack_t *s, long pos) {
+  if (s->starts_num == s->starts_slots) {
+    s->starts_slots = s->starts_slots ? s->starts_slots * 2 : 16;
+    s->starts = realloc(s->starts, sizeof(long) * s->starts_slots);
+  }
+  s->starts[s->starts_num++] = pos;
+}
+
+static long mpc_stack_pops(mpc_stack_t *s) {
+  return s->starts[--s->starts_num];
+}
+
+static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
+  mpc_val_t *x = f(n, (mpc_val_t**)(&s->results[s->results_num-n]));
+  mpc_stack_popr_n(s, n);
+  return x;
+}
+
+static mpc_lerr_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
+  mpc_lerr_t *x = mpc_lerr_or((mpc_lerr_t**)(&s->results[s->results_num-n]), n);
+  mpc_stack_popr_n(s, n);
+  return x;
+}
+
+/*
+** Predictive Dispatch
+**
+** Trying every alternative of an `or` in turn is
+** wasteful when most of them could never start
+** with the next character. So when a parser is
+** defined each `or` it reaches gets a table of
+** the characters each alternative can start with,
+** and the parse skips the ones that can't.
+**
+** Only alternatives we understand completely get
+** a real entry: ones that must consume something
+** and that can't leave errors behind on the way
+** to failing. Everything else can start with any
+** character, so is always tried. Skipping one has
+** to look exactly like trying it and failing, so
+** `mpc_first_err` rebuilds the error it would
+** have given, should that ever be needed.
+**
+** Parsers that consume nothing and can't fail
+** (state, pass, lift) are see-through inside an
+** `and`. `mpca_lang` puts a state in front of
+** every term it builds, so without this no
+** alternative of a grammar would ever get a real
+** entry.
+**
+** Defining any parser might change what another
+** can start with, so every definition bumps the
+** generation and tables from older generations
+** are ignored until they're built again.
+*/
+
+#define MPC_PREDICT_DEPTH 32
+
+static long mpc_generation = 1;
+
+static int mpc_transparent(mpc_parser_t *p) {
+  return p->type == MPC_TYPE_STATE || p->type == MPC_TYPE_PASS
+    || p->type == MPC_TYPE_LIFT || p->type == MPC_TYPE_LIFT_VAL;
+}
+
+/* The first part of an `and` that actually has to match something */
+static mpc_parser_t *mpc_and_head(mpc_parser_t *p) {
+  int i;
+  for (i = 0; i < p->data.and.n; i++) {
+    if (!mpc_transparent(p->data.and.xs[i])) { return p->data.and.xs[i]; }
+  }
+  return NULL;
+}
+
+static int mpc_first(mpc_parser_t *p, unsigned char *first, int depth) {
+  
+  int i;
+  
+  if (depth > MPC_PREDICT_DEPTH) { return 0; }
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_SINGLE:
+      if (p->data.single.x == '\0') { return 0; }
+      mpc_charset_add(first, p->data.single.x);
+      return 1;
+    
+    case MPC_TYPE_RANGE:
+      if (p->data.range.x == '\0') { return 0; }
+      for (i = (unsigned char)p->data.range.x; i <= (unsigned char)p->data.range.y; i++) {
+        mpc_charset_add(first, i);
+      }
+      return 1;
+    
+    case MPC_TYPE_SET:
+      for (i = 0; i < 32; i++) { first[i] |= p->data.set.x[i]; }
+      return 1;
+    
+    case MPC_TYPE_SPAN:
+      if (p->data.span.min == 0) { return 0; }
+      for (i = 0; i < 32; i++) { first[i] |= p->data.span.x[i]; }
+      return 1;
+    
+    case MPC_TYPE_STRING:
+      if (p->data.string.x[0] == '\0') { return 0; }
+      mpc_charset_add(first, p->data.string.x[0]);
+      return 1;
+    
+    case MPC_TYPE_DFA:
+      if (p->data.dfa.accept[0]) { return 0; }
+      for (i = 1; i < 256; i++) {
+        if (p->data.dfa.trans[i] >= 0) { mpc_charset_add(first, i); }
+      }
+      return 1;
+    
+    case MPC_TYPE_EXPECT:   return mpc_first(p->data.expect.x, first, depth+1);
+    case MPC_TYPE_APPLY:    return mpc_first(p->data.apply.x, first, depth+1);
+    case MPC_TYPE_APPLY_TO: return mpc_first(p->data.apply_to.x, first, depth+1);
+    case MPC_TYPE_MANY1:    return mpc_first(p->data.repeat.x, first, depth+1);
+    
+    case MPC_TYPE_COUNT:
+      return p->data.repeat.n > 0 && mpc_first(p->data.repeat.x, first, depth+1);
+    
+    case MPC_TYPE_AND:
+      return mpc_and_head(p) && mpc_first(mpc_and_head(p), first, depth+1);
+    
+    case MPC_TYPE_OR:
+      if (p->data.or.n == 0) { return 0; }
+      for (i = 0; i < p->data.or.n; i++) {
+        if (!mpc_first(p->data.or.xs[i], first, depth+1)) { return 0; }
+      }
+      return 1;
+    
+    default: return 0;
+  }
+  
+}
+
+static mpc_err_t *mpc_first_err(const char *filename, mpc_parser_t *p, mpc_state_t s, char recieved) {
+  
+  int i;
+  mpc_err_t **xs, *e;
+  
+  switch (p->type) {
+    
+    case MPC_TYPE_SPAN:
+      return mpc_err_many1(mpc_err_new(filename, s, p->data.span.m, recieved));
+    
+    case MPC_TYPE_DFA:
+      return mpc_err_new(filename, s, p->data.dfa.expected[0], recieved);
+    
+    case MPC_TYPE_EXPECT:
+      return mpc_err_new(filename, s, p->data.expect.m, recieved);
+    
+    case MPC_TYPE_APPLY:    return mpc_first_err(filename, p->data.apply.x, s, recieved);
+    case MPC_TYPE_APPLY_TO: return mpc_first_err(filename, p->data.apply_to.x, s, recieved);
+    case MPC_TYPE_AND:      return mpc_first_err(filename, mpc_and_head(p), s, recieved);
+    
+    case MPC_TYPE_MANY1:
+      return mpc_err_many1(mpc_first_err(filename, p->data.repeat.x, s, recieved));
+    
+    case MPC_TYPE_COUNT:
+      return mpc_err_count(mpc_first_err(filename, p->data.repeat.x, s, recieved), p->data.repeat.n);
+    
+    case MPC_TYPE_OR:
+      xs = malloc(sizeof(mpc_err_t*) * p->data.or.n);
+      for (i = 0; i < p->data.or.n; i++) {
+        xs[i] = mpc_first_err(filename, p->data.or.xs[i], s, recieved);
+      }
+      e = mpc_err_or(xs, p->data.or.n);
+      free(xs);
+      return e;
+    
+    default:
+      return mpc_err_fail(filename, s, "Incorrect Input");
+  }
+  
+}
+
+static void mpc_predict_or(mpc_parser_t *p) {
+  
+  int i;
+  
+  p->data.or.firsts = realloc(p->data.or.firsts, sizeof(mpc_charset_t) * p->data.or.n);
+  
+  for (i = 0; i < p->data.or.n; i++) {
+    memset(p->data.or.firsts[i], 0, sizeof(mpc_charset_t));
+    if (!mpc_first(p->data.or.xs[i], p->data.or.firsts[i], 0)) {
+      memset(p->data.or.firsts[i], 0xFF, sizeof(mpc_charset_t));
+    }
+  }
+  
+  p->data.or.gen = mpc_generation;
+}
+
+static void mpc_predict_walk(mpc_parser_t *p, mpc_parser_t ***seen, int *seen_num) {
+  
+  int i;
+  
+  for (i = 0; i < *seen_num; i++) {
+    if ((*seen)[i] == p) { return; }
+  }
+  
+  (*seen_num)++;
+  *seen = realloc(*seen, sizeof(mpc_parser_t*) * (*seen_num));
+  (*seen)[*seen_num-1] = p;
+  
+  switch (p->type) {
+    case MPC_TYPE_EXPECT:   mpc_predict_walk(p->data.expect.x, seen, seen_num); break;
+    case MPC_TYPE_APPLY:    mpc_predict_walk(p->data.apply.x, seen, seen_num); break;
+    case MPC_TYPE_APPLY_TO: mpc_predict_walk(p->data.apply_to.x, seen, seen_num); break;
+    case MPC_TYPE_PREDICT:  mpc_predict_walk(p->data.predict.x, seen, seen_num); break;
+    case MPC_TYPE_MEMO:     mpc_predict_walk(p->data.memo.x, seen, seen_num); break;
+    
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+      mpc_predict_walk(p->data.not.x, seen, seen_num);
+      break;
+    
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+      mpc_predict_walk(p->data.repeat.x, seen, seen_num);
+      break;
+    
+    case MPC_TYPE_AND:
+      for (i = 0; i < p->data.and.n; i++) { mpc_predict_walk(p->data.and.xs[i], seen, seen_num); }
+      break;
+    
+    case MPC_TYPE_OR:
+      for (i = 0; i < p->data.or.n; i++) { mpc_predict_walk(p->data.or.xs[i], seen, seen_num); }
+      mpc_predict_or(p);
+      break;
+    
+    default: break;
   }
+  
 }
 
-static mpc_val_t *mpc_stack_merger_out(mpc_stack_t *s, int n, mpc_fold_t f) {
-  mpc_val_t *x = f(n, (mpc_val_t**)(&s->results[s->results_num-n]));
-  mpc_stack_popr_n(s, n);
-  return x;
+/* Builds tables for every `or` reachable from `p` */
+static void mpc_predict(mpc_parser_t *p) {
+  int seen_num = 0;
+  mpc_parser_t **seen = NULL;
+  mpc_predict_walk(p, &seen, &seen_num);
+  free(seen);
 }
 
-static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
-  mpc_err_t *x = mpc_err_or((mpc_err_t**)(&s->results[s->results_num-n]), n);
-  mpc_stack_popr_n(s, n);
-  return x;
+static int mpc_predict_skip(mpc_parser_t *p, int k, char c) {
+  return p->data.or.gen == mpc_generation && !mpc_charset_has(p->data.or.firsts[k], c);
+}
+
+/* Does every way `p` could match start with a known character? */
+int mpc_test_predict(mpc_parser_t *p) {
+  mpc_charset_t first;
+  memset(first, 0, sizeof(mpc_charset_t));
+  return mpc_first(p, first, 0);
 }
 
 /*
@@ -960,7 +1730,7 @@ static mpc_err_t *mpc_stack_merger_err(mpc_stack_t *s, int n) {
 #define MPC_CONTINUE(st, x) mpc_stack_set_state(stk, st); mpc_stack_pushp(stk, x); continue
 #define MPC_SUCCESS(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_out(x), 1); continue
 #define MPC_FAILURE(x) mpc_stack_popp(stk, &p, &st); mpc_stack_pushr(stk, mpc_result_err(x), 0); continue
-#define MPC_PRIMITIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Incorrect Input")); }
+#define MPC_PRIMITIVE(x, f) if (f) { MPC_SUCCESS(x); } else { MPC_FAILURE(mpc_lerr_failure(i->state, "Incorrect Input")); }
 
 int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   
@@ -970,8 +1740,11 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
   mpc_stack_t *stk = mpc_stack_new(i->filename);
   
   /* Variables */
-  char *s;
-  mpc_result_t r;
+  char *s, c;
+  mpc_sresult_t r;
+  mpc_memo_t *m;
+  mpc_lerr_t *e;
+  long pos, n;
 
   /* Go! */
   mpc_stack_pushp(stk, init);
@@ -987,16 +1760,31 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
       case MPC_TYPE_ANY:       MPC_PRIMITIVE(s, mpc_input_any(i, &s));
       case MPC_TYPE_SINGLE:    MPC_PRIMITIVE(s, mpc_input_char(i, p->data.single.x, &s));
       case MPC_TYPE_RANGE:     MPC_PRIMITIVE(s, mpc_input_range(i, p->data.range.x, p->data.range.y, &s));
-      case MPC_TYPE_ONEOF:     MPC_PRIMITIVE(s, mpc_input_oneof(i, p->data.string.x, &s));
-      case MPC_TYPE_NONEOF:    MPC_PRIMITIVE(s, mpc_input_noneof(i, p->data.string.x, &s));
+      case MPC_TYPE_SET:       MPC_PRIMITIVE(s, mpc_input_set(i, p->data.set.x, &s));
       case MPC_TYPE_SATISFY:   MPC_PRIMITIVE(s, mpc_input_satisfy(i, p->data.satisfy.f, &s));
       case MPC_TYPE_STRING:    MPC_PRIMITIVE(s, mpc_input_string(i, p->data.string.x, &s));
       
+      /*
+      ** A span is a `many` or `many1` of a set, and it
+      ** leaves the same error behind when it stops.
+      */
+      
+      case MPC_TYPE_SPAN:
+        n = mpc_input_span(i, p->data.span.x, &s);
+        e = mpc_lerr_expected(i->state, p->data.span.m, mpc_input_peekc(i));
+        if (n >= p->data.span.min) {
+          mpc_stack_err(stk, e);
+          MPC_SUCCESS(s);
+        } else {
+          free(s);
+          MPC_FAILURE(mpc_lerr_repeat(e, 0));
+        }
+      
       /* Other parsers */
       
-      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Parser Undefined!"));      
+      case MPC_TYPE_UNDEFINED: MPC_FAILURE(mpc_lerr_failure(i->state, "Parser Undefined!"));      
       case MPC_TYPE_PASS:      MPC_SUCCESS(NULL);
-      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_err_fail(i->filename, i->state, p->data.fail.m));
+      case MPC_TYPE_FAIL:      MPC_FAILURE(mpc_lerr_failure(i->state, p->data.fail.m));
       case MPC_TYPE_LIFT:      MPC_SUCCESS(p->data.lift.lf());
       case MPC_TYPE_LIFT_VAL:  MPC_SUCCESS(p->data.lift.x);
       case MPC_TYPE_STATE:     MPC_SUCCESS(mpc_state_copy(i->state));
@@ -1005,7 +1793,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         if (mpc_input_anchor(i, p->data.anchor.f)) {
           MPC_SUCCESS(NULL);
         } else {
-          MPC_FAILURE(mpc_err_new(i->filename, i->state, "anchor", mpc_input_peekc(i)));
+          MPC_FAILURE(mpc_lerr_expected(i->state, "anchor", mpc_input_peekc(i)));
         }
       
       /* Application Parsers */
@@ -1016,8 +1804,8 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             MPC_SUCCESS(r.output);
           } else {
-            mpc_err_delete(r.error); 
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, p->data.expect.m, mpc_input_peekc(i)));
+            mpc_lerr_delete(r.error); 
+            MPC_FAILURE(mpc_lerr_expected(i->state, p->data.expect.m, mpc_input_peekc(i)));
           }
         }
       
@@ -1059,7 +1847,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (mpc_stack_popr(stk, &r)) {
             mpc_input_rewind(i);
             p->data.not.dx(r.output);
-            MPC_FAILURE(mpc_err_new(i->filename, i->state, "opposite", mpc_input_peekc(i)));
+            MPC_FAILURE(mpc_lerr_expected(i->state, "opposite", mpc_input_peekc(i)));
           } else {
             mpc_input_unmark(i);
             mpc_stack_err(stk, r.error);
@@ -1100,7 +1888,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           } else {
             if (st == 1) {
               mpc_stack_popr(stk, &r);
-              MPC_FAILURE(mpc_err_many1(r.error));
+              MPC_FAILURE(mpc_lerr_repeat(r.error, 0));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
@@ -1119,7 +1907,7 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
               mpc_stack_popr(stk, &r);
               mpc_stack_popr_out_single(stk, st-1, p->data.repeat.dx);
               mpc_input_rewind(i);
-              MPC_FAILURE(mpc_err_count(r.error, p->data.repeat.n));
+              MPC_FAILURE(mpc_lerr_repeat(r.error, p->data.repeat.n));
             } else {
               mpc_stack_popr(stk, &r);
               mpc_stack_err(stk, r.error);
@@ -1135,16 +1923,22 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
         
         if (p->data.or.n == 0) { MPC_SUCCESS(NULL); }
         
-        if (st == 0) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
-        if (st <= p->data.or.n) {
-          if (mpc_stack_peekr(stk, &r)) {
-            mpc_stack_popr(stk, &r);
-            mpc_stack_popr_err(stk, st-1);
-            MPC_SUCCESS(r.output);
+        if (st > 0 && mpc_stack_peekr(stk, &r)) {
+          mpc_stack_popr(stk, &r);
+          mpc_stack_popr_err(stk, st-1);
+          MPC_SUCCESS(r.output);
+        }
+        
+        if (st < p->data.or.n && p->data.or.gen == mpc_generation) {
+          c = mpc_input_peekc(i);
+          while (st < p->data.or.n && mpc_predict_skip(p, st, c)) {
+            mpc_stack_pushr(stk, mpc_result_err(mpc_lerr_skipped(p->data.or.xs[st], i->state, c)), 0);
+            st++;
           }
-          if (st <  p->data.or.n) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
-          if (st == p->data.or.n) { MPC_FAILURE(mpc_stack_merger_err(stk, p->data.or.n)); }
         }
+        
+        if (st <  p->data.or.n) { MPC_CONTINUE(st+1, p->data.or.xs[st]); }
+        if (st == p->data.or.n) { MPC_FAILURE(mpc_stack_merger_err(stk, p->data.or.n)); }
       
       case MPC_TYPE_AND:
         
@@ -1162,11 +1956,58 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *init, mpc_result_t *final) {
           if (st == p->data.and.n) { mpc_input_unmark(i); MPC_SUCCESS(mpc_stack_merger_out(stk, p->data.and.n, p->data.and.f)); }
         }
       
+      case MPC_TYPE_DFA:
+        if (mpc_input_dfa(i, p->data.dfa.n, p->data.dfa.trans, p->data.dfa.accept, p->data.dfa.expected, &s, &e)) {
+          MPC_SUCCESS(s);
+        } else {
+          MPC_FAILURE(e);
+        }
+      
+      /* Memoized Parsers */
+      
+      /*
+      ** Pipes can't be jumped forward in, so there
+      ** memoization does nothing and st goes to 2.
+      */
+      
+      case MPC_TYPE_MEMO:
+        if (st == 0) {
+          if (i->type == MPC_INPUT_PIPE) { MPC_CONTINUE(2, p->data.memo.x); }
+          m = mpc_stack_memo(stk, p, i->state.pos);
+          if (m->p == p && m->pos == i->state.pos) {
+            i->state = m->state;
+            i->last = m->last;
+            if (i->type == MPC_INPUT_FILE) { fseek(i->file, i->state.pos, SEEK_SET); }
+            if (m->success) {
+              MPC_SUCCESS(p->data.memo.cp(m->result.output));
+            } else {
+              MPC_FAILURE(mpc_lerr_copy(m->result.error));
+            }
+          }
+          mpc_stack_pushs(stk, i->state.pos);
+          MPC_CONTINUE(1, p->data.memo.x);
+        }
+        if (st == 1) {
+          pos = mpc_stack_pops(stk);
+          m = mpc_stack_memo(stk, p, pos);
+          mpc_memo_clear(m);
+          m->p = p;
+          m->pos = pos;
+          m->state = i->state;
+          m->last = i->last;
+          m->success = mpc_stack_peekr(stk, &r);
+          m->result = m->success
+            ? mpc_result_out(p->data.memo.cp(r.output))
+            : mpc_result_err(mpc_lerr_copy(r.error));
+        }
+        mpc_stack_popp(stk, &p, &st);
+        continue;
+      
       /* End */
       
       default:
         
-        MPC_FAILURE(mpc_err_fail(i->filename, i->state, "Unknown Parser Type Id!"));
+        MPC_FAILURE(mpc_lerr_failure(i->state, "Unknown Parser Type Id!"));
     }
   }
   
@@ -1206,6 +2047,7 @@ int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
   
   FILE *f = fopen(filename, "rb");
+  mpc_input_t *i;
   int res;
   
   if (f == NULL) {
@@ -1214,7 +2056,9 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r) {
     return 0;
   }
   
-  res = mpc_parse_file(filename, f, p, r);
+  i = mpc_input_new_contents(filename, f);
+  res = mpc_parse_input(i, p, r);
+  mpc_input_delete(i);
   fclose(f);
   return res;
 }
@@ -1232,6 +2076,7 @@ static void mpc_undefine_or(mpc_parser_t *p) {
     mpc_undefine_unretained(p->data.or.xs[i], 0);
   }
   free(p->data.or.xs);
+  free(p->data.or.firsts);
   
 }
 
@@ -1246,6 +2091,19 @@ static void mpc_undefine_and(mpc_parser_t *p) {
   
 }
 
+static void mpc_undefine_dfa(mpc_parser_t *p) {
+  
+  int i;
+  for (i = 0; i < p->data.dfa.n; i++) {
+    free(p->data.dfa.expected[i]);
+  }
+  free(p->data.dfa.expected);
+  free(p->data.dfa.accept);
+  free(p->data.dfa.trans);
+  free(p->data.dfa.re);
+  
+}
+
 static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
   
   if (p->retained && !force) { return; }
@@ -1254,8 +2112,8 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     
     case MPC_TYPE_FAIL: free(p->data.fail.m); break;
     
-    case MPC_TYPE_ONEOF: 
-    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SPAN: free(p->data.span.m); break;
+    
     case MPC_TYPE_STRING:
       free(p->data.string.x); 
       break;
@@ -1283,6 +2141,9 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force) {
     case MPC_TYPE_OR:  mpc_undefine_or(p);  break;
     case MPC_TYPE_AND: mpc_undefine_and(p); break;
     
+    case MPC_TYPE_MEMO: mpc_undefine_unretained(p->data.memo.x, 0); break;
+    case MPC_TYPE_DFA:  mpc_undefine_dfa(p); break;
+    
     default: break;
   }
   
@@ -1347,6 +2208,10 @@ mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a) {
   }
   
   free(a);
+  
+  mpc_generation++;
+  mpc_predict(p);
+  
   return p;  
 }
 
@@ -1516,21 +2381,24 @@ mpc_parser_t *mpc_range(char s, char e) {
   return mpc_expectf(p, "character between '%c' and '%c'", s, e);
 }
 
-mpc_parser_t *mpc_oneof(const char *s) {
+static mpc_parser_t *mpc_set(const unsigned char *set) {
   mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_ONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
+  p->type = MPC_TYPE_SET;
+  memcpy(p->data.set.x, set, sizeof(mpc_charset_t));
+  return p;
 }
 
-mpc_parser_t *mpc_noneof(const char *s) {
-  mpc_parser_t *p = mpc_undefined();
-  p->type = MPC_TYPE_NONEOF;
-  p->data.string.x = malloc(strlen(s) + 1);
-  strcpy(p->data.string.x, s);
-  return mpc_expectf(p, "one of '%s'", s);
+mpc_parser_t *mpc_oneof(const char *s) {
+  mpc_charset_t set = {0};
+  mpc_charset_add_str(set, s);
+  return mpc_expectf(mpc_set(set), "one of '%s'", s);
+}
 
+mpc_parser_t *mpc_noneof(const char *s) {
+  mpc_charset_t set = {0};
+  mpc_charset_add_str(set, s);
+  mpc_charset_invert(set);
+  return mpc_expectf(mpc_set(set), "one of '%s'", s);
 }
 
 mpc_parser_t *mpc_satisfy(int(*f)(char)) {
@@ -1576,6 +2444,15 @@ mpc_parser_t *mpc_predictive(mpc_parser_t *a) {
   return p;
 }
 
+mpc_parser_t *mpc_memoize(mpc_parser_t *a, mpc_copy_t cp, mpc_dtor_t da) {
+  mpc_parser_t *p = mpc_undefined();
+  p->type = MPC_TYPE_MEMO;
+  p->data.memo.x = a;
+  p->data.memo.cp = cp;
+  p->data.memo.dx = da;
+  return p;
+}
+
 mpc_parser_t *mpc_not_lift(mpc_parser_t *a, mpc_dtor_t da, mpc_ctor_t lf) {
   mpc_parser_t *p = mpc_undefined();
   p->type = MPC_TYPE_NOT;
@@ -1601,8 +2478,38 @@ mpc_parser_t *mpc_maybe(mpc_parser_t *a) {
   return mpc_maybe_lift(a, mpcf_ctor_null);
 }
 
+/*
+** Folding characters from a set into a string one
+** at a time is common enough (and slow enough) that
+** `many` and `many1` of an anonymous `oneof` or
+** `noneof` are turned into a single span instead.
+*/
+
+static mpc_parser_t *mpc_span(mpc_fold_t f, mpc_parser_t *a, int min) {
+  
+  mpc_parser_t *p, *x;
+  
+  if (f != mpcf_strfold || a->retained || a->type != MPC_TYPE_EXPECT) { return NULL; }
+  
+  x = a->data.expect.x;
+  while (!x->retained && x->type == MPC_TYPE_EXPECT) { x = x->data.expect.x; }
+  if (x->retained || x->type != MPC_TYPE_SET) { return NULL; }
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_SPAN;
+  memcpy(p->data.span.x, x->data.set.x, sizeof(mpc_charset_t));
+  p->data.span.min = min;
+  p->data.span.m = a->data.expect.m;
+  
+  a->data.expect.m = NULL;
+  mpc_delete(a);
+  return p;
+}
+
 mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
+  mpc_parser_t *p = mpc_span(f, a, 0);
+  if (p) { return p; }
+  p = mpc_undefined();
   p->type = MPC_TYPE_MANY;
   p->data.repeat.x = a;
   p->data.repeat.f = f;
@@ -1610,7 +2517,9 @@ mpc_parser_t *mpc_many(mpc_fold_t f, mpc_parser_t *a) {
 }
 
 mpc_parser_t *mpc_many1(mpc_fold_t f, mpc_parser_t *a) {
-  mpc_parser_t *p = mpc_undefined();
+  mpc_parser_t *p = mpc_span(f, a, 1);
+  if (p) { return p; }
+  p = mpc_undefined();
   p->type = MPC_TYPE_MANY1;
   p->data.repeat.x = a;
   p->data.repeat.f = f;
@@ -1637,6 +2546,8 @@ mpc_parser_t *mpc_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.gen = 0;
+  p->data.or.firsts = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -1943,32 +2854,30 @@ static const char *mpc_re_range_escape_char(char c) {
   }
 }
 
-static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+/*
+** Fills `set` with the characters in a range, not
+** counting a leading `^`, and returns if there was
+** one. Nothing is expanded into a string first.
+*/
+
+static int mpc_re_range_set(const char *s, unsigned char *set) {
   
-  mpc_parser_t *out;
-  size_t i, j;
-  size_t start, end;
+  size_t i, len = strlen(s);
+  int j, start, end;
   const char *tmp = NULL;
-  const char *s = x;
   int comp = s[0] == '^' ? 1 : 0;
-  char *range = calloc(1,1);
   
-  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
-  if (s[0] == '^' && 
-      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  memset(set, 0, sizeof(mpc_charset_t));
   
-  for (i = comp; i < strlen(s); i++){
+  for (i = comp; i < len; i++){
     
     /* Regex Range Escape */
     if (s[i] == '\\') {
       tmp = mpc_re_range_escape_char(s[i+1]);
       if (tmp != NULL) {
-        range = realloc(range, strlen(range) + strlen(tmp) + 1);
-        strcat(range, tmp);
+        mpc_charset_add_str(set, tmp);
       } else {
-        range = realloc(range, strlen(range) + 1 + 1);
-        range[strlen(range) + 1] = '\0';
-        range[strlen(range) + 0] = s[i+1];      
+        mpc_charset_add(set, s[i+1]);
       }
       i++;
     }
@@ -1976,29 +2885,42 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
     /* Regex Range...Range */
     else if (s[i] == '-') {
       if (s[i+1] == '\0' || i == 0) {
-          range = realloc(range, strlen(range) + strlen("-") + 1);
-          strcat(range, "-");
+        mpc_charset_add(set, '-');
       } else {
-        start = s[i-1]+1;
-        end = s[i+1]-1;
+        start = (unsigned char)s[i-1]+1;
+        end = (unsigned char)s[i+1]-1;
         for (j = start; j <= end; j++) {
-          range = realloc(range, strlen(range) + 1 + 1);
-          range[strlen(range) + 1] = '\0';
-          range[strlen(range) + 0] = j;
-        }        
+          mpc_charset_add(set, j);
+        }
       }
     }
     
     /* Regex Range Normal */
     else {
-      range = realloc(range, strlen(range) + 1 + 1);
-      range[strlen(range) + 1] = '\0';
-      range[strlen(range) + 0] = s[i];
+      mpc_charset_add(set, s[i]);
     }
   
   }
   
-  out = comp == 1 ? mpc_noneof(range) : mpc_oneof(range);
+  return comp;
+}
+
+static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
+  
+  mpc_parser_t *out;
+  mpc_charset_t set;
+  const char *s = x;
+  char *range;
+  int comp;
+  
+  if (s[0] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); } 
+  if (s[0] == '^' && 
+      s[1] == '\0') { free(x); return mpc_fail("Invalid Regex Range Expression"); }
+  
+  comp = mpc_re_range_set(s, set);
+  range = mpc_charset_chars(set);
+  if (comp) { mpc_charset_invert(set); }
+  out = mpc_expectf(mpc_set(set), "one of '%s'", range);
   
   free(x);
   free(range);
@@ -2006,6 +2928,372 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x) {
   return out;
 }
 
+/*
+** ### Compiling to a DFA
+**
+** Running the parsers built above means going
+** through the stack machine, with marks and
+** rewinds, for every single character. So where
+** we can, `mpc_re` instead compiles the regex to
+** a table and runs it as one primitive.
+**
+** The catch is that the parsers above don't have
+** the usual regex meaning. `|` takes the first
+** alternative that matches and repetition never
+** gives characters back, so `a*a` never matches.
+** A DFA on the other hand finds the longest match.
+**
+** The two agree when the regex is deterministic:
+** at every point the next character decides which
+** way to go. That is exactly when the Glushkov
+** automaton (one state per character in the regex,
+** plus a start state) has no two transitions out of
+** a state on the same character, so we build that
+** and it is already our DFA. Add to that rejecting
+** `|` with an empty left side (it always wins) and
+** repeating something that can be empty (it never
+** stops), and the longest match is the match.
+**
+** Counted repeats are the exception. `a{2}` above
+** keeps matching `a` past the second one and then
+** fails if there were more, which no DFA does, so
+** `{` is never compiled.
+**
+** Anything else, including anchors, is left to the
+** parsers above. Getting a regex in by hand is
+** usually simple - `"(\\.|[^"])*"` becomes
+** `"(\\.|[^"\\])*"` for example.
+*/
+
+#define MPC_RE_DFA_MAX 256
+
+enum {
+  MPC_RE_EMPTY,
+  MPC_RE_SET,
+  MPC_RE_CAT,
+  MPC_RE_OR,
+  MPC_RE_MANY,
+  MPC_RE_MANY1,
+  MPC_RE_MAYBE
+};
+
+typedef struct mpc_re_node_t {
+  int type;
+  struct mpc_re_node_t *a;
+  struct mpc_re_node_t *b;
+  mpc_charset_t set;
+  char *expected;
+} mpc_re_node_t;
+
+typedef unsigned char mpc_re_posset_t[MPC_RE_DFA_MAX / 8];
+
+typedef struct {
+  const char *s;
+  int failed;
+  int positions_num;
+  mpc_re_node_t *positions[MPC_RE_DFA_MAX];
+  mpc_re_posset_t follow[MPC_RE_DFA_MAX];
+} mpc_re_dfa_st_t;
+
+static mpc_re_node_t *mpc_re_node(int type, mpc_re_node_t *a, mpc_re_node_t *b) {
+  mpc_re_node_t *n = calloc(1, sizeof(mpc_re_node_t));
+  n->type = type;
+  n->a = a;
+  n->b = b;
+  return n;
+}
+
+static mpc_re_node_t *mpc_re_node_set(const char *chars, int comp, const char *fmt, const char *arg) {
+  mpc_re_node_t *n = mpc_re_node(MPC_RE_SET, NULL, NULL);
+  mpc_charset_add_str(n->set, chars);
+  if (comp) { mpc_charset_invert(n->set); }
+  n->expected = malloc(strlen(fmt) + strlen(arg) + 1);
+  sprintf(n->expected, fmt, arg);
+  return n;
+}
+
+static void mpc_re_node_delete(mpc_re_node_t *n) {
+  if (n == NULL) { return; }
+  mpc_re_node_delete(n->a);
+  mpc_re_node_delete(n->b);
+  free(n->expected);
+  free(n);
+}
+
+/*
+** A little recursive descent parser for the same
+** grammar as above. It gives up on anything the
+** parsers above might read differently from what
+** you'd guess, since they'll be used instead.
+*/
+
+static mpc_re_node_t *mpc_re_dfa_regex(mpc_re_dfa_st_t *st);
+
+static mpc_re_node_t *mpc_re_dfa_base(mpc_re_dfa_st_t *st) {
+  
+  char c = *st->s;
+  char buff[2];
+  char *range;
+  const char *start;
+  int comp;
+  mpc_charset_t set;
+  mpc_re_node_t *r;
+  
+  if (c == '(') {
+    st->s++;
+    r = mpc_re_dfa_regex(st);
+    if (*st->s != ')') { st->failed = 1; return r; }
+    st->s++;
+    return r;
+  }
+  
+  if (c == '[') {
+    start = ++st->s;
+    while (*st->s != ']') {
+      if (*st->s == '\0') { st->failed = 1; return NULL; }
+      st->s += (*st->s == '\\' && st->s[1]) ? 2 : 1;
+    }
+    range = malloc(st->s - start + 1);
+    memcpy(range, start, st->s - start);
+    range[st->s - start] = '\0';
+    st->s++;
+    
+    if (range[0] == '\0' || (range[0] == '^' && range[1] == '\0')) {
+      free(range);
+      st->failed = 1;
+      return NULL;
+    }
+    
+    comp = mpc_re_range_set(range, set);
+    start = mpc_charset_chars(set);
+    r = mpc_re_node_set(start, comp, "one of '%s'", start);
+    free((char*)start);
+    free(range);
+    return r;
+  }
+  
+  if (c == '\\') {
+    c = st->s[1];
+    st->s += 2;
+    switch (c) {
+      case 'a': c = '\a'; break;
+      case 'f': c = '\f'; break;
+      case 'n': c = '\n'; break;
+      case 'r': c = '\r'; break;
+      case 't': c = '\t'; break;
+      case 'v': c = '\v'; break;
+      case 'd': return mpc_re_node_set("0123456789", 0, "%s", "digit");
+      case 's': return mpc_re_node_set(" \f\n\r\t\v", 0, "%s", "whitespace");
+      case 'w': return mpc_re_node_set(
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_", 0, "%s", "alphanumeric");
+      case '\0':
+      case 'b': case 'B': case 'A': case 'Z':
+      case 'D': case 'S': case 'W':
+        st->failed = 1;
+        return NULL;
+      default: break;
+    }
+    buff[0] = c; buff[1] = '\0';
+    return mpc_re_node_set(buff, 0, "'%s'", buff);
+  }
+  
+  if (strchr("^$*+?{", c)) { st->failed = 1; return NULL; }
+  
+  st->s++;
+  if (c == '.') { return mpc_re_node_set("", 1, "%s", "any character"); }
+  buff[0] = c; buff[1] = '\0';
+  return mpc_re_node_set(buff, 0, "'%s'", buff);
+}
+
+static mpc_re_node_t *mpc_re_dfa_factor(mpc_re_dfa_st_t *st) {
+  
+  mpc_re_node_t *b = mpc_re_dfa_base(st);
+  if (st->failed) { return b; }
+  
+  switch (*st->s) {
+    case '*': st->s++; return mpc_re_node(MPC_RE_MANY, b, NULL);
+    case '+': st->s++; return mpc_re_node(MPC_RE_MANY1, b, NULL);
+    case '?': st->s++; return mpc_re_node(MPC_RE_MAYBE, b, NULL);
+    case '{': st->failed = 1; return b;
+    default: return b;
+  }
+}
+
+static mpc_re_node_t *mpc_re_dfa_regex(mpc_re_dfa_st_t *st) {
+  
+  mpc_re_node_t *t = mpc_re_node(MPC_RE_EMPTY, NULL, NULL);
+  
+  while (!st->failed && *st->s != '\0' && *st->s != '|' && *st->s != ')') {
+    t = mpc_re_node(MPC_RE_CAT, t, mpc_re_dfa_factor(st));
+  }
+  
+  if (!st->failed && *st->s == '|') {
+    st->s++;
+    t = mpc_re_node(MPC_RE_OR, t, mpc_re_dfa_regex(st));
+  }
+  
+  return t;
+}
+
+/*
+** Works out the Glushkov sets. Each character set
+** in the regex becomes a position, `first` and
+** `last` are the positions a match can start and
+** end at, and `st->follow` collects which positions
+** can come straight after which. Returns if the
+** node can match nothing, or -1 to give up.
+*/
+
+static void mpc_re_posset_or(mpc_re_posset_t x, mpc_re_posset_t y) {
+  int i;
+  for (i = 0; i < MPC_RE_DFA_MAX / 8; i++) { x[i] |= y[i]; }
+}
+
+static int mpc_re_dfa_glushkov(mpc_re_dfa_st_t *st, mpc_re_node_t *n, mpc_re_posset_t first, mpc_re_posset_t last) {
+  
+  int i, na, nb;
+  mpc_re_posset_t fb, lb;
+  
+  memset(first, 0, sizeof(mpc_re_posset_t));
+  memset(last, 0, sizeof(mpc_re_posset_t));
+  
+  switch (n->type) {
+    
+    case MPC_RE_EMPTY: return 1;
+    
+    case MPC_RE_SET:
+      if (st->positions_num == MPC_RE_DFA_MAX) { return -1; }
+      i = st->positions_num++;
+      st->positions[i] = n;
+      first[i / 8] |= 1 << (i % 8);
+      last[i / 8] |= 1 << (i % 8);
+      return 0;
+    
+    case MPC_RE_CAT:
+    case MPC_RE_OR:
+      na = mpc_re_dfa_glushkov(st, n->a, first, last);
+      nb = na < 0 ? -1 : mpc_re_dfa_glushkov(st, n->b, fb, lb);
+      if (na < 0 || nb < 0) { return -1; }
+      if (n->type == MPC_RE_OR) {
+        if (na) { return -1; }
+        mpc_re_posset_or(first, fb);
+        mpc_re_posset_or(last, lb);
+        return nb;
+      }
+      for (i = 0; i < st->positions_num; i++) {
+        if (last[i / 8] & (1 << (i % 8))) { mpc_re_posset_or(st->follow[i], fb); }
+      }
+      if (na) { mpc_re_posset_or(first, fb); }
+      if (!nb) { memcpy(last, lb, sizeof(mpc_re_posset_t)); } else { mpc_re_posset_or(last, lb); }
+      return na && nb;
+    
+    case MPC_RE_MANY:
+    case MPC_RE_MANY1:
+    case MPC_RE_MAYBE:
+      na = mpc_re_dfa_glushkov(st, n->a, first, last);
+      if (na != 0) { return -1; }
+      if (n->type != MPC_RE_MAYBE) {
+        for (i = 0; i < st->positions_num; i++) {
+          if (last[i / 8] & (1 << (i % 8))) { mpc_re_posset_or(st->follow[i], first); }
+        }
+      }
+      return n->type != MPC_RE_MANY1;
+    
+    default: return -1;
+  }
+}
+
+/*
+** Fills in one row of the table from the set of
+** positions that can come next. Two of them both
+** wanting the same character means the regex isn't
+** deterministic and we give up.
+*/
+
+static int mpc_re_dfa_row(mpc_re_dfa_st_t *st, mpc_pdata_dfa_t *d, int row, mpc_re_posset_t next) {
+  
+  int i, c, k = 0, num = 0;
+  size_t len = 1;
+  char *exp;
+  
+  for (i = 0; i < st->positions_num; i++) {
+    if (!(next[i / 8] & (1 << (i % 8)))) { continue; }
+    for (c = 1; c < 256; c++) {
+      if (!mpc_charset_has(st->positions[i]->set, c)) { continue; }
+      if (d->trans[row * 256 + c] >= 0) { return 0; }
+      d->trans[row * 256 + c] = i + 1;
+    }
+    len += strlen(st->positions[i]->expected) + 4;
+    num++;
+  }
+  
+  /* Join what we expected the way mpc_err_string would */
+  exp = calloc(1, len);
+  for (i = 0; i < st->positions_num; i++) {
+    if (!(next[i / 8] & (1 << (i % 8)))) { continue; }
+    if (k > 0) { strcat(exp, k == num-1 ? " or " : ", "); }
+    strcat(exp, st->positions[i]->expected);
+    k++;
+  }
+  d->expected[row] = exp;
+  
+  return 1;
+}
+
+static mpc_parser_t *mpc_re_dfa(const char *re) {
+  
+  int i, ok, nullable;
+  mpc_re_posset_t first, last;
+  mpc_re_node_t *n;
+  mpc_parser_t *p;
+  mpc_pdata_dfa_t d;
+  mpc_re_dfa_st_t *st = calloc(1, sizeof(mpc_re_dfa_st_t));
+  
+  st->s = re;
+  n = mpc_re_dfa_regex(st);
+  if (st->failed || *st->s != '\0') {
+    mpc_re_node_delete(n);
+    free(st);
+    return NULL;
+  }
+  
+  nullable = mpc_re_dfa_glushkov(st, n, first, last);
+  if (nullable < 0) {
+    mpc_re_node_delete(n);
+    free(st);
+    return NULL;
+  }
+  
+  d.n = st->positions_num + 1;
+  d.trans = malloc(sizeof(short) * 256 * d.n);
+  d.accept = calloc(d.n, 1);
+  d.expected = calloc(d.n, sizeof(char*));
+  for (i = 0; i < 256 * d.n; i++) { d.trans[i] = -1; }
+  
+  ok = mpc_re_dfa_row(st, &d, 0, first);
+  d.accept[0] = nullable;
+  for (i = 0; ok && i < st->positions_num; i++) {
+    ok = mpc_re_dfa_row(st, &d, i + 1, st->follow[i]);
+    d.accept[i + 1] = (last[i / 8] & (1 << (i % 8))) != 0;
+  }
+  
+  mpc_re_node_delete(n);
+  free(st);
+  
+  p = mpc_undefined();
+  p->type = MPC_TYPE_DFA;
+  p->data.dfa = d;
+  p->data.dfa.re = malloc(strlen(re) + 1);
+  strcpy(p->data.dfa.re, re);
+  
+  if (!ok) {
+    mpc_delete(p);
+    return NULL;
+  }
+  
+  return p;
+}
+
 mpc_parser_t *mpc_re(const char *re) {
   
   char *err_msg;
@@ -2013,6 +3301,9 @@ mpc_parser_t *mpc_re(const char *re) {
   mpc_result_t r;
   mpc_parser_t *Regex, *Term, *Factor, *Base, *Range, *RegexEnclose; 
   
+  mpc_parser_t *dfa = mpc_re_dfa(re);
+  if (dfa) { return dfa; }
+  
   Regex  = mpc_new("regex");
   Term   = mpc_new("term");
   Factor = mpc_new("factor");
@@ -2284,13 +3575,21 @@ mpc_val_t *mpcf_trd_free(int n, mpc_val_t **xs) { return mpcf_nth_free(n, xs, 2)
 
 mpc_val_t *mpcf_strfold(int n, mpc_val_t **xs) {
   int i;
-  char *x = calloc(1, 1);
-
+  size_t l = 0, k;
+  char *x;
+  
+  for (i = 0; i < n; i++) { l += strlen(xs[i]); }
+  
+  x = malloc(l + 1);
+  l = 0;
+  
   for (i = 0; i < n; i++) {
-    x = realloc(x, strlen(x) + strlen(xs[i]) + 1);
-    strcat(x, xs[i]);
+    k = strlen(xs[i]);
+    memcpy(x + l, xs[i], k);
+    l += k;
     free(xs[i]);
   }
+  x[l] = '\0';
   return x;
 }
 
@@ -2313,6 +3612,25 @@ mpc_val_t *mpcf_maths(int n, mpc_val_t **xs) {
 ** Printing
 */
 
+static void mpc_print_set(const unsigned char *set) {
+  
+  mpc_charset_t inv;
+  char *chars, *s;
+  int comp = mpc_charset_size(set) > 128;
+  
+  memcpy(inv, set, sizeof(mpc_charset_t));
+  if (comp) { mpc_charset_invert(inv); }
+  
+  chars = mpc_charset_chars(inv);
+  s = mpcf_escape_new(
+    chars,
+    mpc_escape_input_c,
+    mpc_escape_output_c);
+  printf(comp ? "[^%s]" : "[%s]", s);
+  free(s);
+  free(chars);
+}
+
 static void mpc_print_unretained(mpc_parser_t *p, int force) {
   
   /* TODO: Print Everything Escaped */
@@ -2339,6 +3657,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   }
   
   if (p->type == MPC_TYPE_ANY) { printf("<.>"); }
+  if (p->type == MPC_TYPE_DFA) { printf("/%s/", p->data.dfa.re); }
   if (p->type == MPC_TYPE_SATISFY) { printf("<f>"); }
 
   if (p->type == MPC_TYPE_SINGLE) {
@@ -2367,22 +3686,13 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
     free(e);
   }
   
-  if (p->type == MPC_TYPE_ONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[%s]", s);
-    free(s);
+  if (p->type == MPC_TYPE_SET) {
+    mpc_print_set(p->data.set.x);
   }
   
-  if (p->type == MPC_TYPE_NONEOF) {
-    s = mpcf_escape_new(
-      p->data.string.x,
-      mpc_escape_input_c,
-      mpc_escape_output_c);
-    printf("[^%s]", s);
-    free(s);
+  if (p->type == MPC_TYPE_SPAN) {
+    mpc_print_set(p->data.span.x);
+    printf(p->data.span.min ? "+" : "*");
   }
   
   if (p->type == MPC_TYPE_STRING) {
@@ -2397,6 +3707,7 @@ static void mpc_print_unretained(mpc_parser_t *p, int force) {
   if (p->type == MPC_TYPE_APPLY)    { mpc_print_unretained(p->data.apply.x, 0); }
   if (p->type == MPC_TYPE_APPLY_TO) { mpc_print_unretained(p->data.apply_to.x, 0); }
   if (p->type == MPC_TYPE_PREDICT)  { mpc_print_unretained(p->data.predict.x, 0); }
+  if (p->type == MPC_TYPE_MEMO)     { mpc_print_unretained(p->data.memo.x, 0); }
 
   if (p->type == MPC_TYPE_NOT)   { mpc_print_unretained(p->data.not.x, 0); printf("!"); }
   if (p->type == MPC_TYPE_MAYBE) { mpc_print_unretained(p->data.not.x, 0); printf("?"); }
@@ -2519,6 +3830,25 @@ void mpc_ast_delete(mpc_ast_t *a) {
   
 }
 
+mpc_ast_t *mpc_ast_copy(mpc_ast_t *a) {
+  
+  int i;
+  mpc_ast_t *r;
+  
+  if (a == NULL) { return a; }
+  
+  r = mpc_ast_new(a->tag, a->contents);
+  r->state = a->state;
+  r->children_num = a->children_num;
+  r->children = a->children_num ? malloc(sizeof(mpc_ast_t*) * a->children_num) : NULL;
+  
+  for (i = 0; i < a->children_num; i++) {
+    r->children[i] = mpc_ast_copy(a->children[i]);
+  }
+  
+  return r;
+}
+
 static void mpc_ast_delete_no_children(mpc_ast_t *a) {
   free(a->children);
   free(a->tag);
@@ -2737,6 +4067,8 @@ mpc_parser_t *mpca_or(int n, ...) {
   p->type = MPC_TYPE_OR;
   p->data.or.n = n;
   p->data.or.xs = malloc(sizeof(mpc_parser_t*) * n);
+  p->data.or.gen = 0;
+  p->data.or.firsts = NULL;
   
   va_start(va, n);  
   for (i = 0; i < n; i++) {
@@ -2774,6 +4106,7 @@ mpc_parser_t *mpca_and(int n, ...) {
 }
 
 mpc_parser_t *mpca_total(mpc_parser_t *a) { return mpc_total(a, (mpc_dtor_t)mpc_ast_delete); }
+mpc_parser_t *mpca_memoize(mpc_parser_t *a) { return mpc_memoize(a, (mpc_copy_t)mpc_ast_copy, (mpc_dtor_t)mpc_ast_delete); }
 
 /*
 ** Grammar Parser
@@ -3082,6 +4415,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
     left = mpca_grammar_find_parser(stmt->ident, st);
     if (st->flags & MPCA_LANG_PREDICTIVE) { stmt->grammar = mpc_predictive(stmt->grammar); }
     if (stmt->name) { stmt->grammar = mpc_expect(stmt->grammar, stmt->name); }
+    if (st->flags & MPCA_LANG_MEMOIZE) { stmt->grammar = mpca_memoize(stmt->grammar); }
     mpc_define(left, stmt->grammar);
     free(stmt->ident);
     free(stmt->name);
@@ -3095,6 +4429,7 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s) {
 
 static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
   
+  int k;
   mpc_result_t r;
   mpc_err_t *e;
   mpc_parser_t *Lang, *Stmt, *Grammar, *Term, *Factor, *Base; 
@@ -3153,6 +4488,11 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st) {
   
   mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
   
+  /* Everything is defined now, so the tables can be built for good */
+  for (k = 0; e == NULL && k < st->parsers_num; k++) {
+    if (st->parsers[k]) { mpc_predict(st->parsers[k]); }
+  }
+  
   return e;
 }
 
@@ -3244,7 +4584,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...) {
   st.parsers = NULL;
   st.flags = flags;
   
-  i = mpc_input_new_file(filename, f);
+  i = mpc_input_new_contents(filename, f);
   err = mpca_lang_st(i, &st);
   mpc_input_delete(i);
   
@@ -2,6 +2,11 @@
 
 //Mpc is a parser made by Daniel Holden
 #include "mpc.h"
+#include <time.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+#include <limits.h>
 
 /* This preprocessor conditional statement is just for those who compile this on a windows system. */
 #ifdef _WIN32
@@ -9,7 +14,11 @@ static char buffer[2048];
 char *readline(char *prompt)
 {
     fputs(prompt, stdout);
-    fgets(buffer, 2048, stdin);
+    //Like the real thing, NULL means there's no more input
+    if(!fgets(buffer, 2048, stdin))
+    {
+        return NULL;
+    }
     char *cpy = malloc(strlen(buffer)+1);
     strcpy(cpy, buffer);
     cpy[strlen(cpy)-1] = '\0';
@@ -31,50 +40,176 @@ mpc_parser_t *String;
 mpc_parser_t *Comment;
 mpc_parser_t *Sexpr;
 mpc_parser_t *Qexpr;
+mpc_parser_t *Vector;
 mpc_parser_t *Expr;
 mpc_parser_t *Lispy;
 
 /* Forward declarations. */
 struct lval;
 struct lenv;
+struct lcode;
 typedef struct lval lval;
 typedef struct lenv lenv;
+typedef struct lcode lcode;
+
+//Set by the --vm flag. When it's on, everything gets compiled to bytecode before it runs.
+int use_vm = 0;
+
+//Set by the --mpc flag, which reads code with the old mpc grammar instead of our own reader
+int use_mpc = 0;
+
+/* Symbol interning. Every symbol name is stored exactly once in this table, so two symbols are the same symbol if and only if their pointers are equal. No more strcmp! */
+struct
+{
+    int count;
+    int cap;
+    char **names;
+} symtab;
+
+//Each interned name sits right after a little header with what we know about the symbol as a whole
+typedef struct
+{
+    //How many environments other than the global one bind this symbol right now. While it's zero, a lookup can go straight to the global env.
+    int locals;
+    //Set once any lambda has captured this symbol, and never cleared. Until then there can't be a captured value to look for.
+    int captured;
+    //Kept so the table can grow without hashing every name again
+    unsigned long hash;
+    char name[];
+} syminfo;
+
+#define SYM_INFO(s) ((syminfo*)((s) - offsetof(syminfo, name)))
+
+unsigned long sym_hash(char *s, int n);
+char *sym_intern(char *s);
+char *sym_intern_len(char *s, int n);
+void symtab_del(void);
+
+//A few symbols the evaluator cares about, interned once at startup
+char *sym_amp;
+char *sym_if;
+
+/* Bignums. Numbers that won't fit in a fixnum (see below) get boxed, and a boxed number is a bignum: a sign and as many 32 bit digits as it takes. Every result gets squeezed back down into a fixnum whenever it fits, so a bignum is never small. That means zero is always a fixnum, and a fixnum and a bignum are never equal. */
+typedef struct
+{
+    int sign; //-1, 0 or 1
+    int len;
+    uint32_t *d; //Least significant digit first, with no zeros on top
+} lbig;
 
 /* Lisp Value */
-enum { LVAL_ERR, LVAL_NUM, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR };
+enum { LVAL_ERR, LVAL_NUM, LVAL_DBL, LVAL_SYM, LVAL_STR, LVAL_FUN, LVAL_SEXPR, LVAL_QEXPR, LVAL_VEC };
 
 typedef lval*(*lbuiltin)(lenv*, lval*);
 
+/* A value is only ever one type at a time, so its fields share space in a union and the type says which ones mean anything. */
 struct lval 
 {
-    int type;
+    unsigned char type;
 
-    //Basics
-    long num;
-    char *err;
-    char *sym;
-    char *str;
+    //Garbage collector bookkeeping
+    unsigned char mark;
 
-    //Functions
-    lbuiltin builtin;
-    lenv *env;
-    lval *formals;
-    lval *body;
+    /* Values are shared rather than copied, so keep count of who's holding this one. Anything with refs > 1 must not be changed in place: call lval_own first and change what it gives back. */
+    int refs;
 
-    //Expressions
-    int count;
-    lval **cell;
+    lval *gc_prev;
+    lval *gc_next;
+
+    union
+    {
+        //Basics
+        lbig big; //Only for numbers too big to be fixnums
+        double dbl;
+        char *err;
+        char *str;
+
+        //Symbols, plus hints about where to find them (see lenv_lookup)
+        struct
+        {
+            char *sym; //Always interned, never freed
+            int local;
+            int global;
+        };
+
+        //Functions
+        struct
+        {
+            lbuiltin builtin;
+            lenv *env;
+            lval *formals; //Never changes, partial application just moves bound along
+            int bound;
+            int op; //Builtins only: which LOP_ this is, if the evaluator knows how to run it itself
+            lval *body;
+            lcode *code;
+        };
+
+        //Expressions
+        struct
+        {
+            int count;
+            int cap; //How many cells there's room for, so adding one doesn't always mean a realloc
+            lval **cell;
+        };
+
+        //Packed vectors: one flat array of whole numbers or of doubles, never a mix, and no lvals inside
+        struct
+        {
+            int len;
+            char is_dbl;
+            union
+            {
+                int64_t *ints;
+                double *dbls;
+            };
+        };
+    };
 };
 
+/* Fixnums. Most numbers never touch the heap at all: the number lives right in the pointer, shifted up a bit with the low bit set. Real lvals are always aligned, so a pointer with its low bit set can only be a fixnum.
+   Anything that might be a number has to be looked at through LVAL_TYPE, never ->type. FIXNUM_VALUE only works on fixnums, anything else is a bignum and lives in ->big. */
+#define LVAL_FIXNUM(v) ((uintptr_t)(v) & 1)
+#define LVAL_TYPE(v)   (LVAL_FIXNUM(v) ? LVAL_NUM : (v)->type)
+#define LVAL_ZERO(v)   ((uintptr_t)(v) == 1)
+#define FIXNUM_VALUE(v) ((long)((intptr_t)(v) >> 1))
+#define FIXNUM_MAX     (INTPTR_MAX >> 1)
+#define FIXNUM_MIN     (INTPTR_MIN >> 1)
+
 lval *lval_err(char *fmt, ...);
 lval *lval_num(long x);
+lval *lval_num_str(char *s, int n);
+lval *lval_big(lbig b);
+lval *lval_dbl(double x);
+double lval_to_double(lval *v);
+int lval_num_cmp(lval *x, lval *y);
+
+//Bignum arithmetic. Everything hands back a brand new lbig and leaves its arguments alone.
+#define KARATSUBA_CUTOFF 32
+lbig lbig_from_long(long x, uint32_t *buf);
+lbig lbig_view(lval *v, uint32_t *buf);
+lbig lbig_dup(lbig a);
+void lbig_trim(lbig *a);
+int lbig_cmp(lbig a, lbig b);
+lbig lbig_add(lbig a, lbig b);
+lbig lbig_mul(lbig a, lbig b);
+lbig lbig_div(lbig a, lbig b);
+lbig lbig_read(char *s, int n);
+char *lbig_str(lbig a);
+int mag_cmp(uint32_t *a, int an, uint32_t *b, int bn);
+void mag_add_into(uint32_t *r, int rn, uint32_t *t, int tn);
+void mag_sub_into(uint32_t *r, int rn, uint32_t *t, int tn);
+void mag_mul(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn);
+void mag_div(uint32_t *q, uint32_t *a, int an, uint32_t *b, int bn);
 lval *lval_sym(char *s);
+lval *lval_sym_len(char *s, int n);
 lval *lval_str(char *s);
-lval *lval_builtin(lbuiltin func);
+lval *lval_builtin(lbuiltin func, int op);
 
 lenv *lenv_new(void);
 
 lval *lval_lambda(lval *formals, lval *body);
+void lval_resolve(lval *formals, lval *v);
+void lval_capture(lenv *e, lval *formals, lval *v, lval *captured);
 lval *lval_sexpr(void);
 lval *lval_qexpr(void);
 
@@ -83,15 +218,22 @@ void lval_del(lval *v);
 
 lenv *lenv_copy(lenv *e);
 
+lval *lval_ref(lval *v);
 lval *lval_copy(lval *v);
+lval *lval_own(lval *v);
+void lval_reserve(lval *v, int n);
 lval *lval_add(lval *v, lval *x);
 lval *lval_join(lval *x, lval *y);
 lval *lval_pop(lval *v, int i);
 lval *lval_take(lval *v, int i);
+lval *lval_arg(lval *a, int i);
 
 //These are the print functions. Gutenberg would be proud. 
 void lval_print(lval *v);
 void lval_print_expr(lval *v, char open, char close);
+void lval_print_num(lval *v);
+void lval_print_dbl(double x);
+void lval_print_vec(lval *v);
 void lval_print_str(lval *v);
 void lval_println(lval *v);
 
@@ -101,34 +243,153 @@ int lval_eq(lval *x, lval *y);
 char *ltype_name(int t);
 
 //Create the Lisp environment
+/* Entries live in syms/vals in the order they were added (the VM's local slots count on that). Little lambda frames just scan them, but once an env grows past LENV_SMALL entries we build an open-addressing hash index over them as well. */
+#define LENV_SMALL 8
+
 struct lenv
 {
     lenv *par;
     int count;
-    char **syms;
-    lval **vals;
+    int cap;
+    char **syms; //Interned, so compare these with ==
+    lval **vals; //Lives in the same block as syms, right after it
+
+    //What the lambda that owns this env captured when it was made, as symbol, value, symbol, value... (see lval_capture). NULL if nothing.
+    lval *captured;
+
+    //Hash index. Each slot holds an entry number plus one, so zero means empty.
+    int slots;
+    int *index;
+
+    //Garbage collector bookkeeping
+    int mark;
+    lenv *gc_prev;
+    lenv *gc_next;
 };
+
+//The global environment, where every chain of parents ends up
+lenv *lenv_global;
+
+//Running totals for the hashed lookups, reported by env-stats
+struct
+{
+    long lookups;
+    long probes;
+} lenv_stats;
+
 lenv *lenv_new(void);
 void lenv_del(lenv *e);
 lenv *lenv_copy(lenv *e);
+void lenv_grow(lenv *e, int cap);
+unsigned long lenv_hash(char *sym);
+int lenv_find(lenv *e, char *sym);
+int lenv_covers(lenv *e, lenv *x);
+void lenv_reindex(lenv *e);
+lval *lenv_captured(lenv *e, char *sym);
 lval *lenv_get(lenv *e, lval *k);
+lval *lenv_lookup(lenv *e, lval *k);
 void lenv_put(lenv *e, lval *k, lval *v);
 void lenv_def(lenv *e, lval *k, lval *v);
 
+/* Garbage collection. Reference counts free almost everything the moment it stops being used, but anything that slips through the cracks (leaks on error paths, cycles) still sits on the heap. So every lval and lenv is also threaded onto a list, and once the heap has grown by enough we mark everything reachable from the roots and sweep up the rest.
+   Collection only ever happens at safe points at the very top level, where the only values in flight are the ones registered as roots. */
+#ifndef GC_INITIAL
+#define GC_INITIAL (1024 * 1024)
+#endif
+//How much the heap may grow past what survived the last collection before we collect again
+#ifndef GC_GROWTH
+#define GC_GROWTH 2.0
+#endif
+
+struct
+{
+    lval *lvals;
+    lenv *lenvs;
+
+    //Bytes currently allocated for lvals and lenvs, counting what they point at (digits, cells, strings and so on), and how many there can be before the next collection
+    size_t bytes;
+    size_t threshold;
+    double growth;
+
+    //Roots are the global environment, the VM's stacks, and whatever the top level has in hand
+    int toplevel; //Set by main just before it calls load itself
+    //Every nested load adds a couple, so there's no telling how many there'll be
+    int nroots;
+    int rootcap;
+    lval **roots;
+
+    //Running totals, reported by gc-stats
+    long collections;
+    size_t freed;
+    double pause_total;
+    double pause_max;
+} gc;
+
+/* Slabs. lvals and lenvs are all one size each and get made and thrown away constantly, so rather than going to malloc every time, carve them out of big blocks and keep a free list per size class. Like the GC lists and the VM, they're plain globals: the interpreter only ever runs on one thread.
+   Compile with -DLISPY_MALLOC to go straight to malloc and free instead, which is what you want when hunting leaks with valgrind or ASAN. */
+#define SLAB_OBJECTS 512
+
+typedef struct slab_cell
+{
+    struct slab_cell *next;
+} slab_cell;
+
+typedef struct
+{
+    size_t size;
+    slab_cell *free;
+
+    //Every block we've carved up, so they can be handed back at exit
+    int nblocks;
+    void **blocks;
+} slab_class;
+
+void *slab_alloc(slab_class *s);
+void slab_release(slab_class *s, void *p);
+void slab_cleanup(slab_class *s);
+
+lval *lval_alloc(void);
+lenv *lenv_alloc(void);
+void lval_free(lval *v);
+void lenv_free(lenv *e);
+void gc_push_root(lval *v);
+void gc_pop_root(void);
+void gc_mark_lval(lval *v);
+void gc_mark_lenv(lenv *e);
+void gc_sweep(void);
+void gc_collect(void);
+size_t lval_payload(lval *v);
+size_t lenv_payload(lenv *e);
+void gc_safepoint(void);
+void gc_cleanup(void);
+
 /* Let's define some macros because, let's be honest, with some of these variable names, this code is hard enough to read as it is. */
 #define LASSERT(args, cond, fmt, ...) \
     if(!(cond)) { lval *err = lval_err(fmt, ##__VA_ARGS__); lval_del(args); return err; }
 
 #define LASSERT_TYPE(func, args, index, expect) \
-    LASSERT(args, args->cell[index]->type == expect, \
+    LASSERT(args, LVAL_TYPE(args->cell[index]) == expect, \
             "Function '%s' passed incorrect type for argument %i. Got %s, expected %s. ", \
-            func, index, ltype_name(args->cell[index]->type), ltype_name(expect))
+            func, index, ltype_name(LVAL_TYPE(args->cell[index])), ltype_name(expect))
 
 #define LASSERT_NUM(func, args, num) \
     LASSERT(args, args->count == num, \
             "Function '%s' passed incorrect number of arguments. Got %i, expected %i. ", \
             func, args->count, num)
 
+//Whole numbers and floats both count as numbers
+#define LVAL_NUMERIC(v) (LVAL_TYPE(v) == LVAL_NUM || LVAL_TYPE(v) == LVAL_DBL)
+
+#define LASSERT_NUMBER(func, args, index) \
+    LASSERT(args, LVAL_NUMERIC(args->cell[index]), \
+            "Function '%s' passed incorrect type for argument %i. Got %s, expected %s. ", \
+            func, index, ltype_name(LVAL_TYPE(args->cell[index])), ltype_name(LVAL_NUM))
+
+#define LASSERT_NUMBERS(func, args, index) \
+    LASSERT(args, lval_non_number(args->cell[index]) < 0, \
+            "Function '%s' passed a list with a non-number in argument %i. Got %s, expected %s. ", \
+            func, index, ltype_name(LVAL_TYPE(args->cell[index]->cell[lval_non_number(args->cell[index])])), ltype_name(LVAL_NUM))
+
 #define LASSERT_NOT_EMPTY(func, args, index) \
     LASSERT(args, args->cell[index]->count != 0, \
             "Function '%s' passed {} for argument %i. ", func, index);
@@ -137,13 +398,23 @@ void lenv_def(lenv *e, lval *k, lval *v);
 lval *lval_eval(lenv *e, lval *v);
 lval *builtin_lambda(lenv *e, lval *a);
 
+/* Opcodes. The builtins that do the same thing with a different operator all get a number when they're registered, so they can tell which operator they are with a switch instead of a pile of strcmps, and so the evaluator can spot the simple cases and do them itself (see lop_fast). */
+enum { LOP_NONE, LOP_ADD, LOP_SUB, LOP_MUL, LOP_DIV, LOP_GT, LOP_LT, LOP_GE, LOP_LE, LOP_EQ, LOP_NE, LOP_DEF, LOP_PUT };
+
+//What each opcode is called, for error messages
+char *lop_names[] = { "", "+", "-", "*", "/", ">", "<", ">=", "<=", "==", "!=", "def", "=" };
+
+lval *lop_fast(int op, lval **args, int n);
+
 //Built-in functions
 lval *builtin_list(lenv *e, lval *a);
 lval *builtin_head(lenv *e, lval *a);
 lval *builtin_tail(lenv *e, lval *a);
 lval *builtin_eval(lenv *e, lval *a);
+lval *builtin_eval_expr(lval *a);
 lval *builtin_join(lenv *e, lval *a);
-lval *builtin_op(lenv *e, lval *a, char *op);
+lval *builtin_op(lenv *e, lval *a, int op);
+lval *builtin_op_dbl(lval *a, int op);
 
 //Add, subtract, multiply, divide
 lval *builtin_add(lenv *e, lval *a);
@@ -152,10 +423,10 @@ lval *builtin_mul(lenv *e, lval *a);
 lval *builtin_div(lenv *e, lval *a);
 
 //Built-in variable controls
-lval *builtin_var(lenv *e, lval *a, char *func);
+lval *builtin_var(lenv *e, lval *a, int op);
 lval *builtin_def(lenv *e, lval *a);
 lval *builtin_put(lenv *e, lval *a);
-lval *builtin_ord(lenv *e, lval *a, char *op);
+lval *builtin_ord(lenv *e, lval *a, int op);
 
 //Operators!
 lval *builtin_gt(lenv *e, lval *a);
@@ -164,7 +435,55 @@ lval *builtin_ge(lenv *e, lval *a);
 lval *builtin_le(lenv *e, lval *a);
 
 //Comparison
-lval *builtin_cmp(lenv *e, lval *a, char *op);
+lval *builtin_cmp(lenv *e, lval *a, int op);
+
+/* Bulk numeric builtins. These work on a whole Q-Expression of numbers at once. If there's a float anywhere in the list, the whole thing gets copied out into a plain array of doubles and handed to a kernel that works on several of them at a time; otherwise it's whole numbers, which go through the same code + and < do. */
+lval *builtin_sum(lenv *e, lval *a);
+lval *builtin_dot(lenv *e, lval *a);
+lval *builtin_minmax(lenv *e, lval *a, int op);
+lval *builtin_min(lenv *e, lval *a);
+lval *builtin_max(lenv *e, lval *a);
+int lval_non_number(lval *v);
+int lval_any_dbl(lval *v);
+double *lval_gather(lval *v);
+
+//The kernels. Four doubles to a vector, which the compiler turns into whatever SIMD the target has (or plain code if it has none).
+typedef double vdbl __attribute__((vector_size(32)));
+typedef long long vmask __attribute__((vector_size(32)));
+double kernel_sum(double *x, int n);
+double kernel_dot(double *x, double *y, int n);
+double kernel_min(double *x, int n);
+double kernel_max(double *x, int n);
+
+/* Packed vectors. A Q-Expression of numbers is an array of pointers to numbers scattered all over the heap, which is a lot of mallocs and a lot of chasing for a long list. A vector is just the numbers, one after another, so the kernels can run straight down it without gathering anything first.
+   vec and vec->list go back and forth between the two, and every vec- builtin will take a list of numbers in place of a vector and convert it on the way in. */
+lval *lval_vec(int len, int is_dbl);
+lval *lval_vec_from(char *func, lval *v);
+lval *lval_vec_arg(char *func, lval *a, int i);
+void lval_vec_to_dbl(lval *a, int i);
+lval *lval_int128(__int128 x);
+int lval_to_int64(lval *v, int64_t *x);
+lval *builtin_vec(lenv *e, lval *a);
+lval *builtin_vec_list(lenv *e, lval *a);
+lval *builtin_vec_sum(lenv *e, lval *a);
+lval *builtin_vec_dot(lenv *e, lval *a);
+lval *builtin_vec_add(lenv *e, lval *a);
+lval *builtin_vec_sort(lenv *e, lval *a);
+lval *builtin_vec_range(lenv *e, lval *a);
+lval *builtin_vec_fill(lenv *e, lval *a);
+
+//Argument index as a vector, converted from a list of numbers if that's what it is, or bail out with whatever went wrong
+#define LASSERT_VEC(func, args, index) \
+    { lval *verr = lval_vec_arg(func, args, index); if(verr) { lval_del(args); return verr; } }
+
+//Whole-number kernels work on the same four lanes as the double ones, just as 64 bit integers
+typedef unsigned long long vulong __attribute__((vector_size(32)));
+__int128 kernel_sum_int(int64_t *x, int n);
+int kernel_add_int(int64_t *z, int64_t *x, int64_t *y, int n);
+int kernel_adds_int(int64_t *z, int64_t *x, int64_t y, int n);
+void kernel_add_dbl(double *z, double *x, double *y, int n);
+void kernel_adds_dbl(double *z, double *x, double y, int n);
+void kernel_sort(uint64_t *x, int n);
 
 //Equal or not?
 lval *builtin_eq(lenv *e, lval *a);
@@ -172,22 +491,85 @@ lval *builtin_ne(lenv *e, lval *a);
 
 //Various built-ins
 lval *builtin_if(lenv *e, lval *a);
+lval *builtin_if_branch(lval *a);
 lval *builtin_load(lenv *e, lval *a);
 lval *builtin_print(lenv *e, lval *a);
 lval *builtin_error(lenv *e, lval *a);
+lval *builtin_env_stats(lenv *e, lval *a);
+lval *builtin_gc_stats(lenv *e, lval *a);
 void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
+void lenv_add_builtin_op(lenv *e, char *name, lbuiltin func, int op);
 void lenv_add_builtins(lenv *e);
 
 //These functions are for evaluations.
+lval *lval_bind(lenv *e, lval *f, lval **args, int n);
+void lval_del_args(lval **args, int n);
 lval *lval_call(lenv *e, lval *f, lval *a);
 lval *lval_eval_sexpr(lenv *e, lval *v);
 lval *lval_eval(lenv *e, lval *v);
 
+/* Bytecode! Rather than walking the lval tree every single time a function gets called, we can compile it once into a flat list of instructions and let a little virtual machine chew through them. Each op is followed by its operands in the same int array. */
+enum { OP_CONST, OP_LOCAL, OP_LOOKUP, OP_CALL, OP_TAILCALL, OP_JUMP, OP_BRANCH, OP_RETURN };
+
+struct lcode
+{
+    //Shared between copies of the same lambda, so count the references
+    int refs;
+
+    //Instructions and operands
+    int count;
+    int cap;
+    int *ops;
+
+    //Constants pool
+    int nconsts;
+    lval **consts;
+
+    //One slot per distinct formal
+    int nlocals;
+};
+
+lcode *lcode_new(void);
+void lcode_del(lcode *c);
+int lcode_emit(lcode *c, int op);
+int lcode_const(lcode *c, lval *v);
+int lcode_slot(lval *formals, char *sym);
+void lcode_expr(lcode *c, lval *formals, lval *v, int tail);
+void lcode_sexpr(lcode *c, lval *formals, lval *v, int tail);
+lcode *lcode_compile(lval *v);
+lcode *lcode_compile_lambda(lval *formals, lval *body);
+
+//The virtual machine itself
+lval *vm_run(lenv *e, lcode *c, lval *f);
+lval *vm_eval(lenv *e, lval *v);
+
 //These functions are for reading. Reading is good for you, don't you know?
 lval *lval_read_num(mpc_ast_t *t);
 lval *lval_read_str(mpc_ast_t *t);
+lval *lval_read_vec(mpc_ast_t *t);
 lval *lval_read(mpc_ast_t *t);
 
+/* Our own reader. mpc is lovely, but it builds a whole tree of tagged strings for lval_read to pick through afterwards. This walks the text once and builds lvals as it goes. It reads exactly the same language as the grammar in main. */
+typedef struct
+{
+    char *name;
+    char *start;
+    char *s; //Where we're up to
+    int failed; //Set on a syntax error. Errors are values like any other, so the value handed back can't tell us.
+} lreader;
+
+lval *lval_parse(char *filename, char *input);
+lval *lval_parse_file(char *filename);
+lval *lval_parsed(char *filename, int ok, mpc_result_t *r);
+lval *lread_file(char *filename);
+lval *lread_input(char *filename, char *input);
+void lread_skip(lreader *r);
+lval *lread_error(lreader *r, char *expected);
+lval *lread_expr(lreader *r);
+char *lread_num(char *s, int *dbl);
+lval *lread_vec(lreader *r);
+lval *lread_str(lreader *r);
+
 
 
 /************************************************/
@@ -202,30 +584,54 @@ int main(int argc, char** argv)
     Comment = mpc_new("comment");
     Sexpr = mpc_new("sexpr");
     Qexpr = mpc_new("qexpr");
+    Vector = mpc_new("vector");
     Expr = mpc_new("expr");
     Lispy = mpc_new("lispy");
 
     //Now we're actually defining the grammars
     mpca_lang(MPCA_LANG_DEFAULT,
-            "                                             \
-             number  : /-?[0-9]+/ ;                       \
-             symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!*]+/ ; \
-             string  : /\"(\\\\.|[^\"])*\"/ ;             \
-             comment : /;[^\\r\\n]*/ ;                    \
-             sexpr   : '(' <expr>* ')' ;                  \
-             qexpr   : '{' <expr>* '}' ;                  \
-             expr    : <number>  | <symbol> | <string>    \
-                     | <comment> | <sexpr>  | <qexpr>;    \
-             lispy   : /^/ <expr>* /$/ ;                  \
+            "                                                       \
+             number  : /-?[0-9]+(\\.[0-9]+)?([eE][+\\-]?[0-9]+)?/ ; \
+             symbol  : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ;           \
+             string  : /\"(\\\\.|[^\"\\\\])*\"/ ;                   \
+             comment : /;[^\\r\\n]*/ ;                              \
+             sexpr   : '(' <expr>* ')' ;                            \
+             qexpr   : '{' <expr>* '}' ;                            \
+             vector  : \"#{\" (<number> | <comment>)* '}' ;         \
+             expr    : <number>  | <symbol> | <string>              \
+                     | <comment> | <sexpr>  | <qexpr> | <vector>;   \
+             lispy   : /^/ <expr>* /$/ ;                            \
             ",
-            Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+            Number, Symbol, String, Comment, Sexpr, Qexpr, Vector, Expr, Lispy);
+#ifdef LISPY_DEBUG
+    /* Every kind of expression has a known set of characters it can start with, so mpc can skip the ones that can't start with the next character. The sets are allowed to overlap (numbers and symbols can both start with '-' or a digit, and then both get tried), this only checks that none of them could start with just anything. Changing the grammar mustn't lose that. */
+    assert(mpc_test_predict(Expr));
+#endif
     
+    //Intern the symbols the evaluator looks for by name
+    sym_amp = sym_intern("&");
+    sym_if = sym_intern("if");
+
     //Now create an environment for our functions
     lenv *e = lenv_new();
+    lenv_global = e;
     lenv_add_builtins(e);
 
+    gc.threshold = GC_INITIAL;
+    gc.growth = GC_GROWTH;
+
+    //Pull any flags out of the arguments so that only filenames are left
+    int files = 0;
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "--vm") == 0) { use_vm = 1; continue; }
+        if(strcmp(argv[i], "--mpc") == 0) { use_mpc = 1; continue; }
+        if(strncmp(argv[i], "--gc-growth=", 12) == 0) { gc.growth = atof(argv[i] + 12); continue; }
+        argv[++files] = argv[i];
+    }
+
     //Initialize the REPL
-    if(argc == 1)
+    if(files == 0)
     {
         puts("Lispy Version 0.0.Good.Enough.1");
         puts("Press Ctrl+c to Exit \n");
@@ -234,42 +640,45 @@ int main(int argc, char** argv)
         {
             //Print the prompt and get user input
             char *input = readline("lispy> ");
-            add_history(input);
-
-            mpc_result_t r;
-            //Parse the input
-            if(mpc_parse("<stdin>", input, Lispy, &r))
+            //End of input, from Ctrl+d or the end of a pipe
+            if(!input)
             {
-                lval *x = lval_eval(e, lval_read(r.output));
-                lval_println(x);
-                lval_del;
-
-                mpc_ast_delete(r.output);
+                break;
             }
-            //Error control
-            else
+            add_history(input);
+
+            //Parse the input. Parse errors come back as errors, so they just get printed like any other value.
+            lval *x = lval_parse("<stdin>", input);
+            if(LVAL_TYPE(x) != LVAL_ERR)
             {
-                mpc_err_print(r.error);
-                mpc_err_delete(r.error);
+                x = lval_eval(e, x);
             }
+            lval_println(x);
+
+            //Between lines is as safe as it gets, and the value we just printed is the only thing in hand
+            gc_push_root(x);
+            gc_safepoint();
+            gc_pop_root();
+            lval_del(x);
             //Clean up
             free(input);
         }
     }
     
     //File IO!
-    if(argc >= 2)
+    if(files >= 1)
     {
         //Loop over each filename
-        for(int i = 1; i < argc; i++)
+        for(int i = 1; i <= files; i++)
         {
             //Arg list with the filename as the only arg
             lval *args = lval_add(lval_sexpr(), lval_str(argv[i]));
-            //Try to load the file
+            //Try to load the file. This one's coming straight from the top level, so it may collect between expressions.
+            gc.toplevel = 1;
             lval *x = builtin_load(e, args);
             
             //Print any errors
-            if(x->type == LVAL_ERR)
+            if(LVAL_TYPE(x) == LVAL_ERR)
             {
                 lval_println(x);
             }
@@ -278,7 +687,9 @@ int main(int argc, char** argv)
     }
     //Clean up everything
     lenv_del(e);
-    mpc_cleanup(8, Number, Symbol, String, Comment, Sexpr, Qexpr, Expr, Lispy);
+    gc_cleanup();
+    symtab_del();
+    mpc_cleanup(9, Number, Symbol, String, Comment, Sexpr, Qexpr, Vector, Expr, Lispy);
 
     /************************************************\
     |* Here then, as I lay down the pen and proceed *|
@@ -294,903 +705,4300 @@ int main(int argc, char** argv)
 /* Function implementations. Get ready for some MAJOR meat and potatoes. */
 lval *lval_err(char *fmt, ...)
 {
-    lval *v = malloc(sizeof(lval));
+    lval *v = lval_alloc();
     v->type = LVAL_ERR;
+    v->refs = 1;
     va_list va;
     va_start(va, fmt);
     v->err = malloc(512);
     vsnprintf(v->err, 511, fmt, va);
     v->err = realloc(v->err, strlen(v->err)+1);
     va_end(va);
+    gc.bytes += lval_payload(v);
     return v;
 }
 lval *lval_num(long x)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
-    v->num = x;
-    return v;
-}
-lval *lval_sym(char *s)
-{
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
-    return v;
+    //Anything that fits goes right in the pointer
+    if(x >= FIXNUM_MIN && x <= FIXNUM_MAX)
+    {
+        return (lval*)(((uintptr_t)x << 1) | 1);
+    }
+    uint32_t buf[2];
+    return lval_big(lbig_dup(lbig_from_long(x, buf)));
 }
-lval *lval_str(char *s)
+//Read a number written in decimal, with maybe a minus sign in front. There's no such thing as too big anymore.
+lval *lval_num_str(char *s, int n)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_STR;
-    v->str = malloc(strlen(s) + 1);
-    strcpy(v->str, s);
-    return v;
+    //Eighteen digits always fit in a long, so only bigger ones need the bignum treatment
+    if(n - (*s == '-') <= 18)
+    {
+        return lval_num(strtol(s, NULL, 10));
+    }
+    return lval_big(lbig_read(s, n));
 }
-
-
-
-lval *lval_builtin(lbuiltin func)
+//Box up a bignum, or turn it back into a fixnum if it fits. Takes over b's digits.
+lval *lval_big(lbig b)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = func;
+    lbig_trim(&b);
+    if(b.len <= 2)
+    {
+        uint64_t m = b.len ? b.d[0] : 0;
+        if(b.len == 2)
+        {
+            m |= (uint64_t)b.d[1] << 32;
+        }
+        if(b.sign >= 0 ? m <= (uint64_t)FIXNUM_MAX : m <= (uint64_t)FIXNUM_MAX + 1)
+        {
+            free(b.d);
+            long x = b.sign < 0 ? (long)(0 - m) : (long)m;
+            return (lval*)(((uintptr_t)x << 1) | 1);
+        }
+    }
+    lval *v = lval_alloc();
+    v->type = LVAL_NUM;
+    v->refs = 1;
+    v->big = b;
+    gc.bytes += lval_payload(v);
     return v;
 }
-
-
-
-lenv *lenv_new(void)
-{
-    lenv *e = malloc(sizeof(lenv));
-    e->par = NULL;
-    e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
-    return e;
-}
-
-
-
-lval *lval_lambda(lval *formals, lval *body)
+lval *lval_dbl(double x)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = NULL;
-    v->env = lenv_new();
-    v->formals = formals;
-    v->body = body;
+    lval *v = lval_alloc();
+    v->type = LVAL_DBL;
+    v->refs = 1;
+    v->dbl = x;
     return v;
 }
-lval *lval_sexpr(void)
+//A vector of len zeros, whole numbers or doubles
+lval *lval_vec(int len, int is_dbl)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
-    v->count = 0;
-    v->cell = NULL;
+    lval *v = lval_alloc();
+    v->type = LVAL_VEC;
+    v->refs = 1;
+    v->len = len;
+    v->is_dbl = is_dbl;
+    v->ints = calloc(len ? len : 1, sizeof(int64_t));
+    gc.bytes += lval_payload(v);
     return v;
 }
-lval *lval_qexpr(void)
+//Anything that fits in 128 bits, which is everything a sum or product of two int64s can come to
+lval *lval_int128(__int128 x)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
-    v->count = 0;
-    v->cell = NULL;
-    return v;
+    if((long)x == x)
+    {
+        return lval_num((long)x);
+    }
+    unsigned __int128 m = x < 0 ? 0 - (unsigned __int128)x : (unsigned __int128)x;
+    lbig b = { x < 0 ? -1 : 1, 0, malloc(sizeof(uint32_t) * 4) };
+    while(m)
+    {
+        b.d[b.len++] = (uint32_t)m;
+        m >>= 32;
+    }
+    return lval_big(b);
 }
-
-
-
-void lenv_del(lenv *e)
+//Whole number v as an int64, if it fits. Fixnums always do, bignums only just past the fixnum range.
+int lval_to_int64(lval *v, int64_t *x)
 {
-    for(int i =0; i < e->count; i++)
+    if(LVAL_FIXNUM(v))
     {
-        free(e->syms[i]);
-        lval_del(e->vals[i]);
+        *x = FIXNUM_VALUE(v);
+        return 1;
     }
-    free(e->syms);
-    free(e->vals);
-    free(e);
+    if(v->big.len > 2)
+    {
+        return 0;
+    }
+    uint64_t m = v->big.d[0];
+    if(v->big.len == 2)
+    {
+        m |= (uint64_t)v->big.d[1] << 32;
+    }
+    if(v->big.sign > 0 ? m > (uint64_t)INT64_MAX : m > (uint64_t)INT64_MAX + 1)
+    {
+        return 0;
+    }
+    *x = v->big.sign < 0 ? (int64_t)(0 - m) : (int64_t)m;
+    return 1;
 }
-void lval_del(lval *v)
+//Any number as a double, as near as a double can get to it
+double lval_to_double(lval *v)
 {
-    switch(v->type)
+    if(LVAL_FIXNUM(v))
     {
-        case LVAL_NUM:
-            break;
-        case LVAL_FUN:
-            if(!v->builtin)
-            {
-                lenv_del(v->env);
-                lval_del(v->formals);
-                lval_del(v->type);
-            }
-            break;
-        case LVAL_ERR: 
-            free(v->err);
-            break;
-        case LVAL_SYM:
-            free(v->sym);
-            break;
-        case LVAL_STR:
-            free(v->str);
-            break;
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-            for(int i = 0; i < v->count; i++)
-            {
-                lval_del(v->cell[i]);
-            }
-            free(v->cell);
-            break;
+        return (double)FIXNUM_VALUE(v);
+    }
+    if(v->type == LVAL_DBL)
+    {
+        return v->dbl;
+    }
+    double x = 0;
+    for(int i = v->big.len-1; i >= 0; i--)
+    {
+        x = x * 4294967296.0 + v->big.d[i];
     }
-    free(v);
+    return v->big.sign * x;
 }
-
-
-
-lenv *lenv_copy(lenv *e)
+//Compare two numbers of any kind. A float on either side makes it a comparison of doubles.
+int lval_num_cmp(lval *x, lval *y)
 {
-    lenv *n = malloc(sizeof(lenv));
-    n->par = e->par;
-    n->count = e->count;
-    n->syms = malloc(sizeof(char*) * n->count);
-    n->vals = malloc(sizeof(lval*) * n->count);
-    for(int i = 0; i < e->count; i++)
+    if(LVAL_FIXNUM(x) && LVAL_FIXNUM(y))
     {
-        n->syms[i] = malloc(strlen(e->syms[i]) + 1);
-        strcpy(n->syms[i], e->syms[i]);
-        n->vals[i] = lval_copy(e->vals[i]);
+        long a = FIXNUM_VALUE(x);
+        long b = FIXNUM_VALUE(y);
+        return (a > b) - (a < b);
     }
-    return n;
+    if(LVAL_TYPE(x) == LVAL_DBL || LVAL_TYPE(y) == LVAL_DBL)
+    {
+        double a = lval_to_double(x);
+        double b = lval_to_double(y);
+        return (a > b) - (a < b);
+    }
+    uint32_t xbuf[2], ybuf[2];
+    return lbig_cmp(lbig_view(x, xbuf), lbig_view(y, ybuf));
 }
 
 
 
-lval *lval_copy(lval *v)
+//Bignums
+//x as an lbig, using buf (two digits' worth) for the digits. Nothing gets allocated, so don't hang on to it.
+lbig lbig_from_long(long x, uint32_t *buf)
 {
-    lval *x = malloc(sizeof(lval));
-    x->type = v->type;
-    switch(v->type)
+    unsigned long m = x < 0 ? 0UL - (unsigned long)x : (unsigned long)x;
+    lbig b = { x < 0 ? -1 : x > 0, 0, buf };
+    while(m)
     {
-        case LVAL_FUN:
-            if(v->builtin)
-            {
-                x->builtin = v->builtin;
-            }
-            else
-            {
-                x->builtin = NULL;
-                x->env = lenv_copy(v->env);
-                x->formals = lval_copy(v->formals);
-                x->body = lval_copy(v->body);
-            }
-            break;
-        case LVAL_NUM:
-            x->num = v->num;
-            break;
-        case LVAL_ERR:
-            x->err = malloc(strlen(v->err) + 1);
-            strcpy(x->err, v->err);
-            break;
-        case LVAL_SYM:
-            x->sym = malloc(strlen(v->sym) + 1);
-            strcpy(x->str, v->str);
-            break;
-        case LVAL_STR:
-            x->str = malloc(strlen(v->sym) + 1);
-            strcpy(x->str, v->str);
-            break;
-        case LVAL_SEXPR:
-        /* This is nifty. I've never thought about letting same-outcome switch cases fall through like this instead defining each case individually. */
-        case LVAL_QEXPR:
-            x->count = v->count;
-            x->cell = malloc(sizeof(lval*) * x->count);
-            for(int i = 0; i < x->count; i++)
-            {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-            break;
+        buf[b.len++] = (uint32_t)m;
+        m = (m >> 16) >> 16;
     }
-    return x;
+    return b;
 }
-lval *lval_add(lval *v, lval *x)
+//Any number as an lbig, borrowing buf if it's a fixnum. Only good for as long as v is.
+lbig lbig_view(lval *v, uint32_t *buf)
 {
-    v->count++;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
-    return v;
+    return LVAL_FIXNUM(v) ? lbig_from_long(FIXNUM_VALUE(v), buf) : v->big;
 }
-lval *lval_join(lval *x, lval *y)
+lbig lbig_dup(lbig a)
 {
-    for(int i = 0; i < y->count; i++)
+    lbig b = { a.sign, a.len, malloc(sizeof(uint32_t) * (a.len ? a.len : 1)) };
+    memcpy(b.d, a.d, sizeof(uint32_t) * a.len);
+    return b;
+}
+//Drop zeros off the top
+void lbig_trim(lbig *a)
+{
+    while(a->len && a->d[a->len-1] == 0)
     {
-        x = lval_add(x, y->cell[i]);
+        a->len--;
+    }
+    if(a->len == 0)
+    {
+        a->sign = 0;
     }
-    free(y->cell);
-    free(y);
-    return x;
 }
-lval *lval_pop(lval *v, int i)
+int lbig_cmp(lbig a, lbig b)
 {
-    lval *x = v->cell[i];
-    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
-    v->count--;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    return x;
+    if(a.sign != b.sign)
+    {
+        return a.sign < b.sign ? -1 : 1;
+    }
+    return a.sign * mag_cmp(a.d, a.len, b.d, b.len);
 }
-lval *lval_take(lval *v, int i)
+//Subtraction is just adding the negative, so flip b's sign on the way in
+lbig lbig_add(lbig a, lbig b)
 {
-    lval *x = lval_pop(v, i);
-    lval_del(v);
-    return x;
-}
-
+    if(a.sign == 0) { return lbig_dup(b); }
+    if(b.sign == 0) { return lbig_dup(a); }
 
-
-//These are the print functions. Gutenberg would be proud. 
-void lval_print(lval *v)
-{
-    switch(v->type)
+    int n = (a.len > b.len ? a.len : b.len) + 1;
+    lbig r = { a.sign, n, calloc(n, sizeof(uint32_t)) };
+    if(a.sign == b.sign)
     {
-        case LVAL_FUN:
-            if(v->builtin)
-            {
+        memcpy(r.d, a.d, sizeof(uint32_t) * a.len);
+        mag_add_into(r.d, n, b.d, b.len);
+    }
+    //Different signs, so take the smaller one away from the bigger one and keep the bigger one's sign
+    else if(mag_cmp(a.d, a.len, b.d, b.len) >= 0)
+    {
+        memcpy(r.d, a.d, sizeof(uint32_t) * a.len);
+        mag_sub_into(r.d, n, b.d, b.len);
+    }
+    else
+    {
+        memcpy(r.d, b.d, sizeof(uint32_t) * b.len);
+        mag_sub_into(r.d, n, a.d, a.len);
+        r.sign = b.sign;
+    }
+    lbig_trim(&r);
+    return r;
+}
+lbig lbig_mul(lbig a, lbig b)
+{
+    if(a.sign == 0 || b.sign == 0)
+    {
+        lbig z = { 0, 0, NULL };
+        return z;
+    }
+    lbig r = { a.sign * b.sign, a.len + b.len, malloc(sizeof(uint32_t) * (a.len + b.len)) };
+    mag_mul(r.d, a.d, a.len, b.d, b.len);
+    lbig_trim(&r);
+    return r;
+}
+//Rounds towards zero, just like C does. b mustn't be zero.
+lbig lbig_div(lbig a, lbig b)
+{
+    if(mag_cmp(a.d, a.len, b.d, b.len) < 0)
+    {
+        lbig z = { 0, 0, NULL };
+        return z;
+    }
+    lbig q = { a.sign * b.sign, a.len - b.len + 1, malloc(sizeof(uint32_t) * (a.len - b.len + 1)) };
+    mag_div(q.d, a.d, a.len, b.d, b.len);
+    lbig_trim(&q);
+    return q;
+}
+//Nine decimal digits at a time, since a billion still fits in a digit
+lbig lbig_read(char *s, int n)
+{
+    int neg = (*s == '-');
+    s += neg;
+    n -= neg;
+
+    lbig r = { neg ? -1 : 1, 0, malloc(sizeof(uint32_t) * (n / 9 + 1)) };
+    int i = 0;
+    while(i < n)
+    {
+        //The first chunk takes up the slack so the rest are all full
+        int k = i == 0 && n % 9 ? n % 9 : 9;
+        uint32_t chunk = 0;
+        uint32_t scale = 1;
+        for(int j = 0; j < k; j++)
+        {
+            chunk = chunk * 10 + (s[i+j] - '0');
+            scale *= 10;
+        }
+        i += k;
+
+        //r = r * scale + chunk
+        uint64_t carry = chunk;
+        for(int j = 0; j < r.len; j++)
+        {
+            uint64_t cur = (uint64_t)r.d[j] * scale + carry;
+            r.d[j] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        if(carry)
+        {
+            r.d[r.len++] = (uint32_t)carry;
+        }
+    }
+    lbig_trim(&r);
+    return r;
+}
+//Nine decimal digits at a time again: each pass divides the whole thing by a billion and keeps the remainder
+char *lbig_str(lbig a)
+{
+    uint32_t *t = malloc(sizeof(uint32_t) * (a.len ? a.len : 1));
+    memcpy(t, a.d, sizeof(uint32_t) * a.len);
+    int len = a.len;
+
+    //Every digit is worth less than ten decimal digits, so this is plenty of chunks
+    uint32_t *chunks = malloc(sizeof(uint32_t) * (2 * a.len + 1));
+    int n = 0;
+    do
+    {
+        uint64_t rem = 0;
+        for(int i = len-1; i >= 0; i--)
+        {
+            uint64_t cur = (rem << 32) | t[i];
+            t[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+        chunks[n++] = (uint32_t)rem;
+        while(len && t[len-1] == 0)
+        {
+            len--;
+        }
+    } while(len);
+
+    char *str = malloc(9 * n + 2);
+    char *out = str;
+    if(a.sign < 0)
+    {
+        *out++ = '-';
+    }
+    out += sprintf(out, "%u", chunks[n-1]);
+    for(int i = n-2; i >= 0; i--)
+    {
+        out += sprintf(out, "%09u", chunks[i]);
+    }
+    free(chunks);
+    free(t);
+    return str;
+}
+
+//The magnitudes underneath. These don't care about zeros on top, so the halves Karatsuba splits things into can be used as they are.
+int mag_cmp(uint32_t *a, int an, uint32_t *b, int bn)
+{
+    while(an && a[an-1] == 0) { an--; }
+    while(bn && b[bn-1] == 0) { bn--; }
+    if(an != bn)
+    {
+        return an < bn ? -1 : 1;
+    }
+    for(int i = an-1; i >= 0; i--)
+    {
+        if(a[i] != b[i])
+        {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+//r += t, where the answer is known to fit in rn digits
+void mag_add_into(uint32_t *r, int rn, uint32_t *t, int tn)
+{
+    while(tn > rn)
+    {
+        tn--;
+    }
+    uint64_t carry = 0;
+    int i = 0;
+    for(; i < tn; i++)
+    {
+        uint64_t cur = (uint64_t)r[i] + t[i] + carry;
+        r[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+    for(; carry && i < rn; i++)
+    {
+        uint64_t cur = (uint64_t)r[i] + carry;
+        r[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+}
+//r -= t, where r is known to be at least as big as t
+void mag_sub_into(uint32_t *r, int rn, uint32_t *t, int tn)
+{
+    while(tn > rn)
+    {
+        tn--;
+    }
+    uint64_t borrow = 0;
+    int i = 0;
+    for(; i < tn; i++)
+    {
+        uint64_t cur = (uint64_t)r[i] - t[i] - borrow;
+        r[i] = (uint32_t)cur;
+        borrow = (cur >> 32) & 1;
+    }
+    for(; borrow && i < rn; i++)
+    {
+        uint64_t cur = (uint64_t)r[i] - borrow;
+        r[i] = (uint32_t)cur;
+        borrow = (cur >> 32) & 1;
+    }
+}
+/* r = a * b, all an + bn digits of it. r mustn't overlap a or b.
+   Small numbers get multiplied the way you'd do it on paper. Big ones are split in half and done with three multiplications instead of four (Karatsuba), which adds up to a lot less work once the numbers get long. */
+void mag_mul(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
+{
+    if(an < bn)
+    {
+        uint32_t *t = a; a = b; b = t;
+        int tn = an; an = bn; bn = tn;
+    }
+
+    if(bn < KARATSUBA_CUTOFF)
+    {
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        for(int i = 0; i < bn; i++)
+        {
+            uint64_t carry = 0;
+            for(int j = 0; j < an; j++)
+            {
+                uint64_t cur = (uint64_t)a[j] * b[i] + r[i+j] + carry;
+                r[i+j] = (uint32_t)cur;
+                carry = cur >> 32;
+            }
+            r[i+an] = (uint32_t)carry;
+        }
+        return;
+    }
+
+    //Lopsided, so take a on in pieces the size of b
+    if(2 * bn <= an)
+    {
+        memset(r, 0, sizeof(uint32_t) * (an + bn));
+        uint32_t *t = malloc(sizeof(uint32_t) * 2 * bn);
+        for(int i = 0; i < an; i += bn)
+        {
+            int n = an - i < bn ? an - i : bn;
+            mag_mul(t, a + i, n, b, bn);
+            mag_add_into(r + i, an + bn - i, t, n + bn);
+        }
+        free(t);
+        return;
+    }
+
+    //a = a1*B^m + a0 and b = b1*B^m + b0, where b1 can't be empty since b is more than half as long as a
+    int m = an / 2;
+    int n1 = an - m + 1;
+    int n2 = (m > bn - m ? m : bn - m) + 1;
+    uint32_t *sa = calloc(n1 + n2 + n1 + n2, sizeof(uint32_t));
+    uint32_t *sb = sa + n1;
+    uint32_t *z1 = sb + n2;
+
+    //z0 = a0*b0 and z2 = a1*b1 go straight into the bottom and top of r
+    mag_mul(r, a, m, b, m);
+    mag_mul(r + 2*m, a + m, an - m, b + m, bn - m);
+
+    //z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    memcpy(sa, a + m, sizeof(uint32_t) * (an - m));
+    mag_add_into(sa, n1, a, m);
+    memcpy(sb, b, sizeof(uint32_t) * m);
+    mag_add_into(sb, n2, b + m, bn - m);
+    mag_mul(z1, sa, n1, sb, n2);
+    mag_sub_into(z1, n1 + n2, r, 2*m);
+    mag_sub_into(z1, n1 + n2, r + 2*m, an + bn - 2*m);
+
+    //And in it goes, m digits up
+    int zn = n1 + n2;
+    while(zn && z1[zn-1] == 0)
+    {
+        zn--;
+    }
+    mag_add_into(r + m, an + bn - m, z1, zn);
+    free(sa);
+}
+/* q = a / b, an - bn + 1 digits of it, where b has no zeros on top and a is at least as long as b. This is long division (Knuth's algorithm D): guess each digit of the quotient from the top couple of digits, and fix the guess up in the rare case it's off by one. */
+void mag_div(uint32_t *q, uint32_t *a, int an, uint32_t *b, int bn)
+{
+    //Dividing by one digit is easy
+    if(bn == 1)
+    {
+        uint64_t rem = 0;
+        for(int i = an-1; i >= 0; i--)
+        {
+            uint64_t cur = (rem << 32) | a[i];
+            q[i] = (uint32_t)(cur / b[0]);
+            rem = cur % b[0];
+        }
+        return;
+    }
+
+    //Shift everything up until b's top digit has its top bit set, which keeps the guesses close
+    int s = __builtin_clz(b[bn-1]);
+    uint32_t *vn = malloc(sizeof(uint32_t) * (bn + an + 1));
+    uint32_t *un = vn + bn;
+    for(int i = bn-1; i > 0; i--)
+    {
+        vn[i] = (b[i] << s) | (uint32_t)((uint64_t)b[i-1] >> (32 - s));
+    }
+    vn[0] = b[0] << s;
+    un[an] = (uint32_t)((uint64_t)a[an-1] >> (32 - s));
+    for(int i = an-1; i > 0; i--)
+    {
+        un[i] = (a[i] << s) | (uint32_t)((uint64_t)a[i-1] >> (32 - s));
+    }
+    un[0] = a[0] << s;
+
+    for(int j = an - bn; j >= 0; j--)
+    {
+        uint64_t top = ((uint64_t)un[j+bn] << 32) | un[j+bn-1];
+        uint64_t qhat = top / vn[bn-1];
+        uint64_t rhat = top % vn[bn-1];
+        while(qhat >> 32 || qhat * vn[bn-2] > ((rhat << 32) | un[j+bn-2]))
+        {
+            qhat--;
+            rhat += vn[bn-1];
+            if(rhat >> 32)
+            {
+                break;
+            }
+        }
+
+        //Take qhat lots of b away
+        int64_t k = 0;
+        int64_t t;
+        for(int i = 0; i < bn; i++)
+        {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i+j] - k - (int64_t)(p & 0xFFFFFFFF);
+            un[i+j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j+bn] - k;
+        un[j+bn] = (uint32_t)t;
+
+        //Took one too many, so add one back
+        q[j] = (uint32_t)qhat;
+        if(t < 0)
+        {
+            q[j]--;
+            uint64_t carry = 0;
+            for(int i = 0; i < bn; i++)
+            {
+                uint64_t cur = (uint64_t)un[i+j] + vn[i] + carry;
+                un[i+j] = (uint32_t)cur;
+                carry = cur >> 32;
+            }
+            un[j+bn] += (uint32_t)carry;
+        }
+    }
+    free(vn);
+}
+//Symbol interning
+//FNV-1a. Short, sweet, and good enough for symbol names.
+unsigned long sym_hash(char *s, int n)
+{
+    unsigned long h = 14695981039346656037UL;
+    for(int i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211UL;
+    }
+    return h;
+}
+//Hand back the one true copy of s, adding it to the table if it's new
+char *sym_intern(char *s)
+{
+    return sym_intern_len(s, strlen(s));
+}
+//Same thing for the first n chars of s, which doesn't need to be null terminated. The reader uses this to intern names right out of the input.
+char *sym_intern_len(char *s, int n)
+{
+    //Keep the table at most half full so probe runs stay short
+    if((symtab.count + 1) * 2 > symtab.cap)
+    {
+        int cap = symtab.cap ? symtab.cap * 2 : 256;
+        char **names = calloc(cap, sizeof(char*));
+        for(int i = 0; i < symtab.cap; i++)
+        {
+            if(symtab.names[i])
+            {
+                unsigned long j = SYM_INFO(symtab.names[i])->hash & (cap-1);
+                while(names[j])
+                {
+                    j = (j+1) & (cap-1);
+                }
+                names[j] = symtab.names[i];
+            }
+        }
+        free(symtab.names);
+        symtab.names = names;
+        symtab.cap = cap;
+    }
+
+    unsigned long h = sym_hash(s, n);
+    unsigned long i = h & (symtab.cap-1);
+    while(symtab.names[i])
+    {
+        char *name = symtab.names[i];
+        if(SYM_INFO(name)->hash == h && strncmp(name, s, n) == 0 && name[n] == '\0')
+        {
+            return name;
+        }
+        i = (i+1) & (symtab.cap-1);
+    }
+    syminfo *info = malloc(sizeof(syminfo) + n + 1);
+    info->locals = 0;
+    info->captured = 0;
+    info->hash = h;
+    memcpy(info->name, s, n);
+    info->name[n] = '\0';
+    symtab.names[i] = info->name;
+    symtab.count++;
+    return symtab.names[i];
+}
+void symtab_del(void)
+{
+    for(int i = 0; i < symtab.cap; i++)
+    {
+        if(symtab.names[i])
+        {
+            free(SYM_INFO(symtab.names[i]));
+        }
+    }
+    free(symtab.names);
+    symtab.names = NULL;
+    symtab.count = 0;
+    symtab.cap = 0;
+}
+lval *lval_sym(char *s)
+{
+    return lval_sym_len(s, strlen(s));
+}
+lval *lval_sym_len(char *s, int n)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_SYM;
+    v->refs = 1;
+    v->sym = sym_intern_len(s, n);
+    v->local = -1;
+    v->global = -1;
+    return v;
+}
+lval *lval_str(char *s)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_STR;
+    v->refs = 1;
+    v->str = malloc(strlen(s) + 1);
+    strcpy(v->str, s);
+    gc.bytes += lval_payload(v);
+    return v;
+}
+
+
+
+lval *lval_builtin(lbuiltin func, int op)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_FUN;
+    v->refs = 1;
+    v->builtin = func;
+    v->op = op;
+    return v;
+}
+
+
+
+lenv *lenv_new(void)
+{
+    lenv *e = lenv_alloc();
+    e->par = NULL;
+    e->count = 0;
+    e->cap = 0;
+    e->syms = NULL;
+    e->vals = NULL;
+    e->captured = NULL;
+    e->slots = 0;
+    e->index = NULL;
+    return e;
+}
+
+
+
+lval *lval_lambda(lval *formals, lval *body)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_FUN;
+    v->refs = 1;
+    v->builtin = NULL;
+    v->env = lenv_new();
+    v->formals = formals;
+    v->bound = 0;
+    v->body = body;
+    lval_resolve(formals, body);
+    //Compile the body up front while we still have every formal to hand out slots for
+    v->code = use_vm ? lcode_compile_lambda(formals, body) : NULL;
+    return v;
+}
+//Work out once, when the lambda is made, where each symbol in v is going to be found: one of the formals, or somewhere in the global env. Nested Q-Expressions get the same treatment, since they're usually code waiting for if or eval.
+void lval_resolve(lval *formals, lval *v)
+{
+    switch(LVAL_TYPE(v))
+    {
+        case LVAL_SYM:
+            v->local = lcode_slot(formals, v->sym);
+            v->global = v->local < 0 ? lenv_find(lenv_global, v->sym) : -1;
+            break;
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++)
+            {
+                lval_resolve(formals, v->cell[i]);
+            }
+            break;
+    }
+}
+/* Closures. A lambda made inside another one captures whatever its body uses from where it's made: every symbol that isn't one of its own formals and is bound locally somewhere up e's chain, or was captured by one of those lambdas in turn. Globals are never captured, they're looked up when the lambda runs like always.
+   Scoping is still dynamic first. A captured value only gets used when no local in scope at the time of the call binds the name, but it's used ahead of the global env (see lenv_get), so defining some unrelated global later can't change what a closure sees. */
+void lval_capture(lenv *e, lval *formals, lval *v, lval *captured)
+{
+    switch(LVAL_TYPE(v))
+    {
+        case LVAL_SYM:
+        {
+            if(v->sym == sym_amp || lcode_slot(formals, v->sym) >= 0)
+            {
+                break;
+            }
+            for(int i = 0; i < captured->count; i += 2)
+            {
+                if(captured->cell[i]->sym == v->sym)
+                {
+                    return;
+                }
+            }
+            lval *x = NULL;
+            //Nobody but the global env binds it, so there's no point looking
+            if(SYM_INFO(v->sym)->locals > 0)
+            {
+                for(lenv *p = e; p && p != lenv_global && !x; p = p->par)
+                {
+                    int i = lenv_find(p, v->sym);
+                    x = i >= 0 ? p->vals[i] : NULL;
+                }
+            }
+            if(!x)
+            {
+                x = lenv_captured(e, v->sym);
+            }
+            if(x)
+            {
+                SYM_INFO(v->sym)->captured = 1;
+                lval_add(captured, lval_ref(v));
+                lval_add(captured, lval_ref(x));
+            }
+            break;
+        }
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++)
+            {
+                lval_capture(e, formals, v->cell[i], captured);
+            }
+            break;
+    }
+}
+lval *lval_sexpr(void)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_SEXPR;
+    v->refs = 1;
+    v->count = 0;
+    v->cap = 0;
+    v->cell = NULL;
+    return v;
+}
+lval *lval_qexpr(void)
+{
+    lval *v = lval_alloc();
+    v->type = LVAL_QEXPR;
+    v->refs = 1;
+    v->count = 0;
+    v->cap = 0;
+    v->cell = NULL;
+    return v;
+}
+
+
+
+void lenv_del(lenv *e)
+{
+    for(int i =0; i < e->count; i++)
+    {
+        if(e != lenv_global)
+        {
+            SYM_INFO(e->syms[i])->locals--;
+        }
+        lval_del(e->vals[i]);
+    }
+    if(e->captured)
+    {
+        lval_del(e->captured);
+    }
+    gc.bytes -= lenv_payload(e);
+    free(e->syms);
+    free(e->index);
+    lenv_free(e);
+}
+void lval_del(lval *v)
+{
+    //Only the last one out turns off the lights
+    if(LVAL_FIXNUM(v) || --v->refs > 0)
+    {
+        return;
+    }
+    gc.bytes -= lval_payload(v);
+    switch(v->type)
+    {
+        case LVAL_NUM:
+            free(v->big.d);
+            break;
+        case LVAL_VEC:
+            free(v->ints);
+            break;
+        case LVAL_FUN:
+            if(!v->builtin)
+            {
+                lenv_del(v->env);
+                lval_del(v->formals);
+                lval_del(v->body);
+                if(v->code)
+                {
+                    lcode_del(v->code);
+                }
+            }
+            break;
+        case LVAL_ERR: 
+            free(v->err);
+            break;
+        case LVAL_STR:
+            free(v->str);
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for(int i = 0; i < v->count; i++)
+            {
+                lval_del(v->cell[i]);
+            }
+            free(v->cell);
+            break;
+    }
+    lval_free(v);
+}
+
+
+
+lenv *lenv_copy(lenv *e)
+{
+    lenv *n = lenv_alloc();
+    n->par = e->par;
+    n->count = 0;
+    n->cap = 0;
+    n->syms = NULL;
+    n->vals = NULL;
+    lenv_grow(n, e->count);
+    n->count = e->count;
+    for(int i = 0; i < e->count; i++)
+    {
+        n->syms[i] = e->syms[i];
+        n->vals[i] = lval_ref(e->vals[i]);
+        SYM_INFO(n->syms[i])->locals++;
+    }
+    //Captures never change once they're made, so copies can share them
+    n->captured = e->captured ? lval_ref(e->captured) : NULL;
+    //Entries keep their positions, so the index carries over as is
+    n->slots = e->slots;
+    n->index = NULL;
+    if(e->index)
+    {
+        n->index = malloc(sizeof(int) * n->slots);
+        memcpy(n->index, e->index, sizeof(int) * n->slots);
+        gc.bytes += sizeof(int) * n->slots;
+    }
+    return n;
+}
+
+
+
+//Make room for at least cap entries. syms and vals share a single block, so an env only ever costs one allocation.
+void lenv_grow(lenv *e, int cap)
+{
+    if(cap <= e->cap)
+    {
+        return;
+    }
+    char **syms = malloc((sizeof(char*) + sizeof(lval*)) * cap);
+    lval **vals = (lval**)(syms + cap);
+    if(e->count)
+    {
+        memcpy(syms, e->syms, sizeof(char*) * e->count);
+        memcpy(vals, e->vals, sizeof(lval*) * e->count);
+    }
+    free(e->syms);
+    gc.bytes += (sizeof(char*) + sizeof(lval*)) * (cap - e->cap);
+    e->syms = syms;
+    e->vals = vals;
+    e->cap = cap;
+}
+
+
+
+//Share v with one more owner
+lval *lval_ref(lval *v)
+{
+    if(LVAL_FIXNUM(v))
+    {
+        return v;
+    }
+    v->refs++;
+    return v;
+}
+//Make a new lval that looks just like v. Only the top level is new, anything inside is shared with v.
+lval *lval_copy(lval *v)
+{
+    //Fixnums are values, not objects. There's nothing to copy.
+    if(LVAL_FIXNUM(v))
+    {
+        return v;
+    }
+    lval *x = lval_alloc();
+    x->type = v->type;
+    x->refs = 1;
+    switch(v->type)
+    {
+        case LVAL_FUN:
+            if(v->builtin)
+            {
+                x->builtin = v->builtin;
+                x->op = v->op;
+            }
+            else
+            {
+                x->builtin = NULL;
+                x->env = lenv_copy(v->env);
+                x->formals = lval_ref(v->formals);
+                x->bound = v->bound;
+                x->body = lval_ref(v->body);
+                //Bytecode never changes once it's compiled, so copies can share it
+                x->code = v->code;
+                if(x->code)
+                {
+                    x->code->refs++;
+                }
+            }
+            break;
+        case LVAL_NUM:
+            x->big = lbig_dup(v->big);
+            break;
+        case LVAL_DBL:
+            x->dbl = v->dbl;
+            break;
+        case LVAL_VEC:
+            x->len = v->len;
+            x->is_dbl = v->is_dbl;
+            x->ints = malloc(sizeof(int64_t) * (v->len ? v->len : 1));
+            memcpy(x->ints, v->ints, sizeof(int64_t) * v->len);
+            break;
+        case LVAL_ERR:
+            x->err = malloc(strlen(v->err) + 1);
+            strcpy(x->err, v->err);
+            break;
+        case LVAL_SYM:
+            //Interned, so copying a symbol is just copying the pointer
+            x->sym = v->sym;
+            x->local = v->local;
+            x->global = v->global;
+            break;
+        case LVAL_STR:
+            x->str = malloc(strlen(v->str) + 1);
+            strcpy(x->str, v->str);
+            break;
+        case LVAL_SEXPR:
+        /* This is nifty. I've never thought about letting same-outcome switch cases fall through like this instead defining each case individually. */
+        case LVAL_QEXPR:
+            x->count = v->count;
+            x->cap = v->count;
+            x->cell = malloc(sizeof(lval*) * x->count);
+            for(int i = 0; i < x->count; i++)
+            {
+                x->cell[i] = lval_ref(v->cell[i]);
+            }
+            break;
+    }
+    gc.bytes += lval_payload(x);
+    return x;
+}
+//Copy on write. Takes over the caller's reference to v and hands back one that nobody else can see, copying only if v is shared.
+lval *lval_own(lval *v)
+{
+    if(LVAL_FIXNUM(v) || v->refs == 1)
+    {
+        return v;
+    }
+    lval *x = lval_copy(v);
+    lval_del(v);
+    return x;
+}
+//Make room in v (which must be owned) for at least n cells. Doubling as we go means a run of adds only reallocs a handful of times.
+void lval_reserve(lval *v, int n)
+{
+    if(n <= v->cap)
+    {
+        return;
+    }
+    int cap = v->cap ? v->cap * 2 : 4;
+    if(cap < n)
+    {
+        cap = n;
+    }
+    v->cell = realloc(v->cell, sizeof(lval*) * cap);
+    gc.bytes += sizeof(lval*) * (cap - v->cap);
+    v->cap = cap;
+}
+lval *lval_add(lval *v, lval *x)
+{
+    v = lval_own(v);
+    lval_reserve(v, v->count + 1);
+    v->cell[v->count++] = x;
+    return v;
+}
+lval *lval_join(lval *x, lval *y)
+{
+    x = lval_own(x);
+    lval_reserve(x, x->count + y->count);
+
+    //If nobody else has y we can just steal its cells, otherwise share them
+    int steal = (y->refs == 1);
+    for(int i = 0; i < y->count; i++)
+    {
+        x->cell[x->count++] = steal ? y->cell[i] : lval_ref(y->cell[i]);
+    }
+    if(steal)
+    {
+        gc.bytes -= lval_payload(y);
+        free(y->cell);
+        lval_free(y);
+    }
+    else
+    {
+        lval_del(y);
+    }
+    return x;
+}
+//v must be owned by the caller (see lval_own). The room the popped cell leaves behind is kept for next time.
+lval *lval_pop(lval *v, int i)
+{
+    lval *x = v->cell[i];
+    memmove(&v->cell[i], &v->cell[i+1], sizeof(lval*) * (v->count-i-1));
+    v->count--;
+    return x;
+}
+lval *lval_take(lval *v, int i)
+{
+    //No need to pop anything out since v is going away, and this way it doesn't matter whether v is shared
+    lval *x = lval_ref(v->cell[i]);
+    lval_del(v);
+    return x;
+}
+/* Hand over arg i of a, which must be owned by the caller, without shuffling the rest down the way lval_pop does. A fixnum is left in its place, and since that needs no freeing, a can still be deleted as a whole once the builtin is done with it.
+   This is how a builtin walks its args one at a time: by index, in order, and then one lval_del at the end. */
+lval *lval_arg(lval *a, int i)
+{
+    lval *x = a->cell[i];
+    a->cell[i] = lval_num(0);
+    return x;
+}
+
+
+
+//These are the print functions. Gutenberg would be proud. 
+void lval_print(lval *v)
+{
+    switch(LVAL_TYPE(v))
+    {
+        case LVAL_FUN:
+            if(v->builtin)
+            {
                 printf("<builtin>");
             }
-            else
+            else
+            {
+                //Only the formals that are still waiting for args
+                printf("\\ {");
+                for(int i = v->bound; i < v->formals->count; i++)
+                {
+                    lval_print(v->formals->cell[i]);
+                    if(i != (v->formals->count-1))
+                    {
+                        putchar(' ');
+                    }
+                }
+                printf("} ");
+                lval_print(v->body);
+                putchar(')');
+            }
+            break;
+        case LVAL_NUM:   lval_print_num(v); break;
+        case LVAL_DBL:   lval_print_dbl(v->dbl); break;
+        case LVAL_ERR:   printf("Error: %s", v->err); break;
+        case LVAL_SYM:   printf("%s", v->sym); break;
+        case LVAL_STR:   lval_print_str(v); break;
+        case LVAL_SEXPR: lval_print_expr(v, '(', ')'); break;
+        case LVAL_QEXPR: lval_print_expr(v, '{', '}'); break;
+        case LVAL_VEC:   lval_print_vec(v); break;
+    }
+}
+void lval_print_expr(lval *v, char open, char close)
+{
+    putchar(open);
+    for(int i = 0; i < v->count; i++)
+    {
+        lval_print(v->cell[i]);
+        if(i != (v->count-1))
+        {
+            putchar(' ');
+        }
+    }
+    putchar(close);
+}
+void lval_print_num(lval *v)
+{
+    if(LVAL_FIXNUM(v))
+    {
+        printf("%li", FIXNUM_VALUE(v));
+        return;
+    }
+    char *digits = lbig_str(v->big);
+    printf("%s", digits);
+    free(digits);
+}
+//The shortest thing that reads back as the same double, and always with a point or an exponent in it so that it reads back as a float at all. The one exception is NaN, which has no way to be written down and prints as nan or -nan.
+void lval_print_dbl(double x)
+{
+    //There's no literal for infinity, but any number too big for a double reads as one
+    if(isinf(x))
+    {
+        printf(x > 0 ? "1e999" : "-1e999");
+        return;
+    }
+    char buf[32];
+    for(int digits = 15; digits <= 17; digits++)
+    {
+        snprintf(buf, sizeof(buf), "%.*g", digits, x);
+        if(strtod(buf, NULL) == x)
+        {
+            break;
+        }
+    }
+    printf("%s", buf);
+    if(!strpbrk(buf, ".eni"))
+    {
+        printf(".0");
+    }
+}
+void lval_print_str(lval *v)
+{
+    //Make a copy of the string
+    char *escaped = malloc(strlen(v->str)+1);
+    strcpy(escaped, v->str);
+    //Pass it through the escape function
+    escaped = mpcf_escape(escaped);
+    //Print it between double quotation characters
+    printf("\"%s\"", escaped);
+    //Clean up the copied string
+    free(escaped);
+}
+//Vectors print like the Q-Expression they'd turn back into, with a # in front so they can't be mistaken for one
+void lval_print_vec(lval *v)
+{
+    printf("#{");
+    for(int i = 0; i < v->len; i++)
+    {
+        if(v->is_dbl)
+        {
+            lval_print_dbl(v->dbls[i]);
+        }
+        else
+        {
+            printf("%lli", (long long)v->ints[i]);
+        }
+        if(i != (v->len-1))
+        {
+            putchar(' ');
+        }
+    }
+    putchar('}');
+}
+void lval_println(lval *v)
+{
+    lval_print(v);
+    putchar('\n');
+}
+
+
+
+//Equality is a good thing. This is our version of affirmative action.
+int lval_eq(lval *x, lval *y)
+{
+    //A float equals a whole number with the same value
+    if(LVAL_NUMERIC(x) && LVAL_NUMERIC(y) && (LVAL_TYPE(x) == LVAL_DBL || LVAL_TYPE(y) == LVAL_DBL))
+    {
+        return lval_to_double(x) == lval_to_double(y);
+    }
+    if(LVAL_TYPE(x) != LVAL_TYPE(y))
+    {
+        return 0;
+    }
+    
+    //Basically just some type checking
+    switch(LVAL_TYPE(x))
+    {
+        //A fixnum can only equal another fixnum, and then they're the very same pointer
+        case LVAL_NUM: return(LVAL_FIXNUM(x) || LVAL_FIXNUM(y) ? x == y : lbig_cmp(x->big, y->big) == 0);
+        case LVAL_ERR: return(strcmp(x->err, y->err) == 0);
+        case LVAL_SYM: return(x->sym == y->sym);
+        case LVAL_STR: return(strcmp(x->str, y->str) == 0);
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+                       if(x->count != y->count)
+                       {
+                           return 0;
+                       }
+                       for(int i = 0; i < x->count; i++)
+                       {
+                           if(!lval_eq(x->cell[i], y->cell[i]))
+                           {
+                               return 0;
+                           }
+                       }
+                       return 1;
+                       break;
+        //Same kind of numbers, same length, same numbers. An empty vector of whole numbers and an empty one of floats aren't the same thing either.
+        case LVAL_VEC:
+                       if(x->is_dbl != y->is_dbl || x->len != y->len)
+                       {
+                           return 0;
+                       }
+                       for(int i = 0; i < x->len; i++)
+                       {
+                           if(x->is_dbl ? x->dbls[i] != y->dbls[i] : x->ints[i] != y->ints[i])
+                           {
+                               return 0;
+                           }
+                       }
+                       return 1;
+    }
+    return 0;
+}
+
+
+
+char *ltype_name(int t)
+{
+    switch(t)
+    {
+        case LVAL_FUN:   return "Function";
+        case LVAL_NUM:   return "Number";
+        case LVAL_DBL:   return "Float";
+        case LVAL_ERR:   return "Error";
+        case LVAL_SYM:   return "Symbol";
+        case LVAL_STR:   return "String";
+        case LVAL_SEXPR: return "S-Expression";
+        case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_VEC:   return "Vector";
+        default:         return "Unknown";
+    }
+}
+
+
+
+//Create the Lisp environment
+//Symbols are interned, so the pointer itself makes a fine key. Mix the bits up a little since the low ones are mostly alignment.
+unsigned long lenv_hash(char *sym)
+{
+    unsigned long h = (unsigned long)sym;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdUL;
+    h ^= h >> 33;
+    return h;
+}
+//Find the entry number for sym in this env only, or -1 if it isn't here
+int lenv_find(lenv *e, char *sym)
+{
+    if(!e->index)
+    {
+        for(int i = 0; i < e->count; i++)
+        {
+            if(e->syms[i] == sym)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    lenv_stats.lookups++;
+    unsigned long i = lenv_hash(sym) & (e->slots-1);
+    while(e->index[i])
+    {
+        lenv_stats.probes++;
+        int j = e->index[i] - 1;
+        if(e->syms[j] == sym)
+        {
+            return j;
+        }
+        i = (i+1) & (e->slots-1);
+    }
+    lenv_stats.probes++;
+    return -1;
+}
+//Does e bind every name x does, and capture the same things? Then with e in front of it, nothing could ever be found in x.
+int lenv_covers(lenv *e, lenv *x)
+{
+    if(x->captured && x->captured != e->captured)
+    {
+        return 0;
+    }
+    for(int i = 0; i < x->count; i++)
+    {
+        if(lenv_find(e, x->syms[i]) < 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+//Rebuild the hash index from scratch, big enough to stay at most half full
+void lenv_reindex(lenv *e)
+{
+    int slots = 16;
+    while(slots < e->count * 2)
+    {
+        slots *= 2;
+    }
+    gc.bytes += sizeof(int) * slots - (e->index ? sizeof(int) * e->slots : 0);
+    free(e->index);
+    e->slots = slots;
+    e->index = calloc(slots, sizeof(int));
+    for(int j = 0; j < e->count; j++)
+    {
+        unsigned long i = lenv_hash(e->syms[j]) & (slots-1);
+        while(e->index[i])
+        {
+            i = (i+1) & (slots-1);
+        }
+        e->index[i] = j + 1;
+    }
+}
+//Locals first, from the innermost call outwards, then whatever the lambdas we're in captured, and the global env last of all
+lval *lenv_get(lenv *e, lval *k)
+{
+    lenv *x = e;
+    for(; x && x != lenv_global; x = x->par)
+    {
+        int i = lenv_find(x, k->sym);
+        if(i >= 0)
+        {
+            return lval_ref(x->vals[i]);
+        }
+    }
+    lval *v = lenv_captured(e, k->sym);
+    if(v)
+    {
+        return lval_ref(v);
+    }
+    int i = x ? lenv_find(x, k->sym) : -1;
+    return i >= 0 ? lval_ref(x->vals[i]) : lval_err("Unbound Symbol '%s'", k->sym);
+}
+//The value the nearest lambda in e's chain captured for sym, or NULL if none of them did. Not a new reference.
+lval *lenv_captured(lenv *e, char *sym)
+{
+    for(; e; e = e->par)
+    {
+        if(!e->captured)
+        {
+            continue;
+        }
+        for(int i = 0; i < e->captured->count; i += 2)
+        {
+            if(e->captured->cell[i]->sym == sym)
+            {
+                return e->captured->cell[i+1];
+            }
+        }
+    }
+    return NULL;
+}
+/* Look up a symbol that's being evaluated, trying its hints before doing a real search. A symbol's local hint is its slot among the formals of the lambda it appears in, and its global hint is its slot in the global env.
+   Scoping is dynamic (a lambda's parent is whoever called it), so no hint can be trusted outright: each one is checked before it's used, and if it's wrong we fall back to lenv_get. That also means it doesn't matter when one symbol is shared between lambdas that disagree about it. */
+lval *lenv_lookup(lenv *e, lval *k)
+{
+    //One of our own formals
+    if(k->local >= 0 && k->local < e->count && e->syms[k->local] == k->sym)
+    {
+        return lval_ref(e->vals[k->local]);
+    }
+
+    //Nobody but the global env binds it and no lambda ever captured it, so that's the only place it can be
+    if(SYM_INFO(k->sym)->locals == 0 && !SYM_INFO(k->sym)->captured)
+    {
+        lenv *g = lenv_global;
+        if(k->global < 0 || k->global >= g->count || g->syms[k->global] != k->sym)
+        {
+            k->global = lenv_find(g, k->sym);
+            if(k->global < 0)
+            {
+                return lval_err("Unbound Symbol '%s'", k->sym);
+            }
+        }
+        return lval_ref(g->vals[k->global]);
+    }
+    return lenv_get(e, k);
+}
+void lenv_put(lenv *e, lval *k, lval *v)
+{
+    int i = lenv_find(e, k->sym);
+    if(i >= 0)
+    {
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_ref(v);
+        return;
+    }
+
+    //Grow by doubling rather than one realloc per definition
+    if(e->count == e->cap)
+    {
+        lenv_grow(e, e->cap ? e->cap * 2 : 4);
+    }
+    e->count++;
+    e->vals[e->count-1] = lval_ref(v);
+    e->syms[e->count-1] = k->sym;
+    if(e != lenv_global)
+    {
+        SYM_INFO(k->sym)->locals++;
+    }
+
+    if(e->count <= LENV_SMALL)
+    {
+        return;
+    }
+    if(!e->index || e->count * 2 > e->slots)
+    {
+        lenv_reindex(e);
+        return;
+    }
+    unsigned long j = lenv_hash(k->sym) & (e->slots-1);
+    while(e->index[j])
+    {
+        j = (j+1) & (e->slots-1);
+    }
+    e->index[j] = e->count;
+}
+void lenv_def(lenv *e, lval *k, lval *v)
+{
+    while(e->par)
+    {
+        e = e->par;
+    }
+    lenv_put(e, k ,v);
+}
+
+
+
+//Prepare for built-ins. Lots and lots of built-ins.
+lval *lval_eval(lenv *e, lval *v)
+{
+    //Hand S-Expressions off to the VM if the user asked for it
+    if(use_vm && LVAL_TYPE(v) == LVAL_SEXPR)
+    {
+        return vm_eval(e, v);
+    }
+    if(LVAL_TYPE(v) == LVAL_SYM)
+    {
+        lval *x = lenv_lookup(e, v);
+        lval_del(v);
+        return x;
+    }
+    if(LVAL_TYPE(v) == LVAL_SEXPR)
+    {
+        return lval_eval_sexpr(e, v);
+    }
+    return v;
+}
+
+
+
+//Gee, look at all these built-ins!
+//This function allows our users to utilize lambda expressions
+lval *builtin_lambda(lenv *e, lval *a)
+{
+    LASSERT_NUM("\\", a, 2);
+    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+
+    for(int i = 0; i < a->cell[0]->count; i++)
+    {
+        LASSERT(a, (LVAL_TYPE(a->cell[0]->cell[i]) == LVAL_SYM),
+                "Cannot define non-symbol. Got %s, Expected %s. ",
+                ltype_name(LVAL_TYPE(a->cell[0]->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    lval *formals = lval_pop(a, 0);
+    lval *body = lval_pop(a , 0);
+    lval_del(a);
+    lval *f = lval_lambda(formals, body);
+
+    //Made inside another lambda, so there may be locals worth holding on to
+    if(e != lenv_global)
+    {
+        lval *captured = lval_qexpr();
+        lval_capture(e, formals, body, captured);
+        if(captured->count)
+        {
+            f->env->captured = captured;
+        }
+        else
+        {
+            lval_del(captured);
+        }
+    }
+    return f;
+}
+//This one lets our users implement lists
+lval *builtin_list(lenv *e, lval *a)
+{
+    a = lval_own(a);
+    a->type = LVAL_QEXPR;
+    return a;
+}
+//This builds-in the head function
+lval *builtin_head(lenv *e, lval *a)
+{
+    LASSERT_NUM("head", a, 1);
+    LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("head", a, 0);
+
+    lval* v = lval_own(lval_take(a, 0));
+    for(int i = 1; i < v->count; i++)
+    {
+        lval_del(v->cell[i]);
+    }
+    v->count = 1;
+    return v;
+}
+//This implements the tail function
+lval *builtin_tail(lenv *e, lval *a)
+{
+    LASSERT_NUM("tail", a, 1);
+    LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY("tail", a, 0);
+
+    lval *v = lval_own(lval_take(a, 0));
+    lval_del(lval_pop(v, 0));
+    return v;
+}
+//This implements the eval ability
+lval *builtin_eval(lenv *e, lval *a)
+{
+    return lval_eval(e, builtin_eval_expr(a));
+}
+//Everything eval does short of actually evaluating: hands back the S-Expression to evaluate, or an error. The evaluator uses this to treat eval as a tail call.
+lval *builtin_eval_expr(lval *a)
+{
+    LASSERT_NUM("eval", a, 1);
+    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
+
+    lval *x = lval_own(lval_take(a, 0));
+    x->type = LVAL_SEXPR;
+    return x;
+}
+//This implements the join keyword
+lval *builtin_join(lenv *e, lval *a)
+{
+    for(int i = 0; i < a->count; i++)
+    {
+        LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+    }
+    a = lval_own(a);
+    lval *x = lval_arg(a, 0);
+    
+    for(int i = 1; i < a->count; i++)
+    {
+        x = lval_join(x, lval_arg(a, i));
+    }
+    lval_del(a);
+    return x;
+}
+//Not-so-black ops! Just implementing built in mathematical operators
+lval *builtin_op(lenv *e, lval *a, int op)
+{
+    int dbl = 0;
+    for(int i = 0; i < a->count; i++)
+    {
+        LASSERT_NUMBER(lop_names[op], a, i);
+        dbl |= LVAL_TYPE(a->cell[i]) == LVAL_DBL;
+    }
+    if(dbl)
+    {
+        return builtin_op_dbl(a, op);
+    }
+
+    /* Do the math on plain longs and only make an lval at the very end, which for fixnums costs nothing. That lasts for as long as everything's a fixnum and nothing overflows, which is nearly always.
+       The moment either of those stops being true, i says how far we got and the rest gets done with bignums. */
+    int i = 1;
+    long x = 0;
+    long r;
+    if(LVAL_FIXNUM(a->cell[0]))
+    {
+        x = FIXNUM_VALUE(a->cell[0]);
+
+        if(op == LOP_SUB && a->count == 1)
+        {
+            //If subtraction is required, just do some unary negation
+            x = -x;
+        }
+
+        //Pick the operator once, and then each one gets a loop all to itself
+        switch(op)
+        {
+            case LOP_ADD:
+                for(; i < a->count && LVAL_FIXNUM(a->cell[i]); i++)
+                {
+                    if(__builtin_add_overflow(x, FIXNUM_VALUE(a->cell[i]), &r)) { break; }
+                    x = r;
+                }
+                break;
+            case LOP_SUB:
+                for(; i < a->count && LVAL_FIXNUM(a->cell[i]); i++)
+                {
+                    if(__builtin_sub_overflow(x, FIXNUM_VALUE(a->cell[i]), &r)) { break; }
+                    x = r;
+                }
+                break;
+            case LOP_MUL:
+                for(; i < a->count && LVAL_FIXNUM(a->cell[i]); i++)
+                {
+                    if(__builtin_mul_overflow(x, FIXNUM_VALUE(a->cell[i]), &r)) { break; }
+                    x = r;
+                }
+                break;
+            //Dividing only ever makes x smaller, so there's nothing to overflow
+            case LOP_DIV:
+                for(; i < a->count && LVAL_FIXNUM(a->cell[i]); i++)
+                {
+                    long y = FIXNUM_VALUE(a->cell[i]);
+                    if(y == 0)
+                    {
+                        lval_del(a);
+                        return lval_err("Division by zero. Not cool. ");
+                    }
+                    x /= y;
+                }
+                break;
+        }
+        if(i == a->count)
+        {
+            lval_del(a);
+            return lval_num(x);
+        }
+    }
+
+    //Bignums from here on
+    uint32_t buf[2];
+    lbig acc;
+    if(LVAL_FIXNUM(a->cell[0]))
+    {
+        acc = lbig_dup(lbig_from_long(x, buf));
+    }
+    else
+    {
+        acc = lbig_dup(a->cell[0]->big);
+        if(op == LOP_SUB && a->count == 1)
+        {
+            acc.sign = -acc.sign;
+        }
+    }
+    for(; i < a->count; i++)
+    {
+        lbig y = lbig_view(a->cell[i], buf);
+        lbig z;
+        switch(op)
+        {
+            case LOP_ADD: z = lbig_add(acc, y); break;
+            case LOP_SUB: y.sign = -y.sign; z = lbig_add(acc, y); break;
+            case LOP_MUL: z = lbig_mul(acc, y); break;
+            default:
+                if(y.sign == 0)
+                {
+                    free(acc.d);
+                    lval_del(a);
+                    return lval_err("Division by zero. Not cool. ");
+                }
+                z = lbig_div(acc, y);
+                break;
+        }
+        free(acc.d);
+        acc = z;
+    }
+    lval_del(a);
+    return lval_big(acc);
+}
+//A float anywhere makes the whole sum a sum of floats
+lval *builtin_op_dbl(lval *a, int op)
+{
+    double x = lval_to_double(a->cell[0]);
+
+    if(op == LOP_SUB && a->count == 1)
+    {
+        x = -x;
+    }
+
+    switch(op)
+    {
+        case LOP_ADD:
+            for(int i = 1; i < a->count; i++) { x += lval_to_double(a->cell[i]); }
+            break;
+        case LOP_SUB:
+            for(int i = 1; i < a->count; i++) { x -= lval_to_double(a->cell[i]); }
+            break;
+        case LOP_MUL:
+            for(int i = 1; i < a->count; i++) { x *= lval_to_double(a->cell[i]); }
+            break;
+        case LOP_DIV:
+            for(int i = 1; i < a->count; i++)
+            {
+                double y = lval_to_double(a->cell[i]);
+                if(y == 0)
+                {
+                    lval_del(a);
+                    return lval_err("Division by zero. Not cool. ");
+                }
+                x /= y;
+            }
+            break;
+    }
+    lval_del(a);
+    return lval_dbl(x);
+}
+/* The common cases, done without an S-Expression to hold the args: one or two fixnums and an opcode that works on numbers. The args are only looked at, never taken, and the answer is exactly what the builtin would have said.
+   Returns NULL for anything else, and then the caller calls the builtin the long way round. */
+lval *lop_fast(int op, lval **args, int n)
+{
+    if(n < 1 || n > 2 || !LVAL_FIXNUM(args[0]) || !LVAL_FIXNUM(args[n-1]))
+    {
+        return NULL;
+    }
+    //Fixnums are a bit short of a long, so only multiplying can overflow
+    long x = FIXNUM_VALUE(args[0]);
+
+    if(n == 1)
+    {
+        switch(op)
+        {
+            case LOP_SUB: return lval_num(-x);
+            case LOP_ADD:
+            case LOP_MUL:
+            case LOP_DIV: return lval_num(x);
+            default:      return NULL;
+        }
+    }
+
+    long y = FIXNUM_VALUE(args[1]);
+    long r;
+    switch(op)
+    {
+        case LOP_ADD: return lval_num(x + y);
+        case LOP_SUB: return lval_num(x - y);
+        case LOP_MUL: return __builtin_mul_overflow(x, y, &r) ? NULL : lval_num(r);
+        case LOP_DIV: return y ? lval_num(x / y) : lval_err("Division by zero. Not cool. ");
+        case LOP_GT:  return lval_num(x >  y);
+        case LOP_LT:  return lval_num(x <  y);
+        case LOP_GE:  return lval_num(x >= y);
+        case LOP_LE:  return lval_num(x <= y);
+        case LOP_EQ:  return lval_num(x == y);
+        case LOP_NE:  return lval_num(x != y);
+        default:      return NULL;
+    }
+}
+
+
+
+//Add, subtract, multiply, divide. Handle these operators by calling their implementations.
+lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, LOP_ADD); }
+lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, LOP_SUB); }
+lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, LOP_MUL); }
+lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, LOP_DIV); }
+
+//Built-in variable controls PLUS error handling/reporting at NO EXTRA CHARGE!
+lval *builtin_var(lenv *e, lval *a, int op)
+{
+    char *func = lop_names[op];
+
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+
+    lval *syms = a->cell[0];
+    for(int i = 0; i < syms->count; i++)
+    {
+        LASSERT(a, (LVAL_TYPE(syms->cell[i]) == LVAL_SYM),
+                "Function '%s' cannot define non-symbol. "
+                "Got %s, expected %s. ",
+                func, ltype_name(LVAL_TYPE(syms->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    LASSERT(a, (syms->count == a->count-1),
+            "Function '%s' passed too many arguments for symbols. "
+            "Got %i, expected %i. ",
+            func, syms->count, a->count-1);
+
+    for(int i = 0; i < syms->count; i++)
+    {
+        if(op == LOP_DEF) { lenv_def(e, syms->cell[i], a->cell[i+1]); }
+        if(op == LOP_PUT) { lenv_put(e, syms->cell[i], a->cell[i+1]); }
+    }
+    lval_del(a);
+    return lval_sexpr();
+}
+lval *builtin_def(lenv *e, lval *a) { return builtin_var(e, a, LOP_DEF); }
+lval *builtin_put(lenv *e, lval *a) { return builtin_var(e, a, LOP_PUT); }
+
+
+
+//Rules for comparison operators
+lval *builtin_ord(lenv *e, lval *a, int op)
+{
+    LASSERT_NUM(lop_names[op], a, 2);
+    LASSERT_NUMBER(lop_names[op], a, 0);
+    LASSERT_NUMBER(lop_names[op], a, 1);
+
+    int c = lval_num_cmp(a->cell[0], a->cell[1]);
+
+    int r;
+    switch(op)
+    {
+        case LOP_GT: r = (c >  0); break;
+        case LOP_LT: r = (c <  0); break;
+        case LOP_GE: r = (c >= 0); break;
+        default:     r = (c <= 0); break;
+    }
+    
+    lval_del(a);
+    return lval_num(r);
+}
+//Deal with comparison operators by calling their implementations
+lval *builtin_gt(lenv *e, lval *a) { return builtin_ord(e, a, LOP_GT); }
+lval *builtin_lt(lenv *e, lval *a) { return builtin_ord(e, a, LOP_LT); }
+lval *builtin_ge(lenv *e, lval *a) { return builtin_ord(e, a, LOP_GE); }
+lval *builtin_le(lenv *e, lval *a) { return builtin_ord(e, a, LOP_LE); }
+
+
+
+//Rulesets for == and !=
+lval *builtin_cmp(lenv *e, lval *a, int op)
+{
+    LASSERT_NUM(lop_names[op], a, 2);
+    int r = lval_eq(a->cell[0], a->cell[1]);
+    if(op == LOP_NE) { r = !r; }
+    lval_del(a);
+    return lval_num(r);
+}
+//Handle == and != by calling their implementations
+lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, LOP_EQ); }
+lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, LOP_NE); }
+
+
+
+//Bulk numeric builtins
+lval *builtin_sum(lenv *e, lval *a)
+{
+    LASSERT_NUM("sum", a, 1);
+    LASSERT_TYPE("sum", a, 0, LVAL_QEXPR);
+    LASSERT_NUMBERS("sum", a, 0);
+
+    lval *v = a->cell[0];
+    if(v->count == 0)
+    {
+        lval_del(a);
+        return lval_num(0);
+    }
+    if(lval_any_dbl(v))
+    {
+        double *x = lval_gather(v);
+        double s = kernel_sum(x, v->count);
+        free(x);
+        lval_del(a);
+        return lval_dbl(s);
+    }
+
+    //Whole numbers are just + over the list, which already knows all about fixnums and bignums
+    v = lval_own(lval_take(a, 0));
+    v->type = LVAL_SEXPR;
+    return builtin_op(e, v, LOP_ADD);
+}
+lval *builtin_dot(lenv *e, lval *a)
+{
+    LASSERT_NUM("dot", a, 2);
+    LASSERT_TYPE("dot", a, 0, LVAL_QEXPR);
+    LASSERT_TYPE("dot", a, 1, LVAL_QEXPR);
+    LASSERT_NUMBERS("dot", a, 0);
+    LASSERT_NUMBERS("dot", a, 1);
+    LASSERT(a, a->cell[0]->count == a->cell[1]->count,
+            "Function 'dot' passed lists of different lengths. Got %i and %i. ",
+            a->cell[0]->count, a->cell[1]->count);
+
+    lval *x = a->cell[0];
+    lval *y = a->cell[1];
+    int n = x->count;
+    if(lval_any_dbl(x) || lval_any_dbl(y))
+    {
+        double *xs = lval_gather(x);
+        double *ys = lval_gather(y);
+        double s = kernel_dot(xs, ys, n);
+        free(xs);
+        free(ys);
+        lval_del(a);
+        return lval_dbl(s);
+    }
+
+    //Plain longs for as long as nothing overflows, then bignums for whatever's left
+    long s = 0;
+    int i = 0;
+    for(; i < n && LVAL_FIXNUM(x->cell[i]) && LVAL_FIXNUM(y->cell[i]); i++)
+    {
+        long p;
+        if(__builtin_mul_overflow(FIXNUM_VALUE(x->cell[i]), FIXNUM_VALUE(y->cell[i]), &p) || __builtin_add_overflow(s, p, &p))
+        {
+            break;
+        }
+        s = p;
+    }
+    lval *acc = lval_num(s);
+    for(; i < n; i++)
+    {
+        lval *p = builtin_op(e, lval_add(lval_add(lval_sexpr(), lval_ref(x->cell[i])), lval_ref(y->cell[i])), LOP_MUL);
+        acc = builtin_op(e, lval_add(lval_add(lval_sexpr(), acc), p), LOP_ADD);
+    }
+    lval_del(a);
+    return acc;
+}
+//min is op LOP_LT and max is LOP_GT: keep whichever number is less than (or greater than) everything else
+lval *builtin_minmax(lenv *e, lval *a, int op)
+{
+    char *func = op == LOP_LT ? "min" : "max";
+    LASSERT_NUM(func, a, 1);
+    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
+    LASSERT_NOT_EMPTY(func, a, 0);
+    LASSERT_NUMBERS(func, a, 0);
+
+    lval *v = a->cell[0];
+    if(lval_any_dbl(v))
+    {
+        double *x = lval_gather(v);
+        double m = op == LOP_LT ? kernel_min(x, v->count) : kernel_max(x, v->count);
+        free(x);
+        lval_del(a);
+        return lval_dbl(m);
+    }
+
+    int sign = op == LOP_LT ? -1 : 1;
+    lval *best = v->cell[0];
+    for(int i = 1; i < v->count; i++)
+    {
+        if(lval_num_cmp(v->cell[i], best) * sign > 0)
+        {
+            best = v->cell[i];
+        }
+    }
+    best = lval_ref(best);
+    lval_del(a);
+    return best;
+}
+lval *builtin_min(lenv *e, lval *a) { return builtin_minmax(e, a, LOP_LT); }
+lval *builtin_max(lenv *e, lval *a) { return builtin_minmax(e, a, LOP_GT); }
+//Where the first thing in v that isn't a number is, or -1 if they all are
+int lval_non_number(lval *v)
+{
+    for(int i = 0; i < v->count; i++)
+    {
+        if(!LVAL_NUMERIC(v->cell[i]))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+int lval_any_dbl(lval *v)
+{
+    for(int i = 0; i < v->count; i++)
+    {
+        if(LVAL_TYPE(v->cell[i]) == LVAL_DBL)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+//Copy a list of numbers out into an array of doubles, so the kernels can run straight down it
+double *lval_gather(lval *v)
+{
+    double *x = malloc(sizeof(double) * (v->count ? v->count : 1));
+    for(int i = 0; i < v->count; i++)
+    {
+        x[i] = lval_to_double(v->cell[i]);
+    }
+    return x;
+}
+
+
+
+//The kernels. Two vectors at a time keeps two adds going at once. The lanes get added up at the very end, so a sum can come out a rounding error away from what adding left to right would give.
+double kernel_sum(double *x, int n)
+{
+    vdbl acc0 = { 0 };
+    vdbl acc1 = { 0 };
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        vdbl a, b;
+        memcpy(&a, x + i, sizeof(vdbl));
+        memcpy(&b, x + i + 4, sizeof(vdbl));
+        acc0 += a;
+        acc1 += b;
+    }
+    acc0 += acc1;
+    double s = (acc0[0] + acc0[1]) + (acc0[2] + acc0[3]);
+    for(; i < n; i++)
+    {
+        s += x[i];
+    }
+    return s;
+}
+double kernel_dot(double *x, double *y, int n)
+{
+    vdbl acc0 = { 0 };
+    vdbl acc1 = { 0 };
+    int i = 0;
+    for(; i + 8 <= n; i += 8)
+    {
+        vdbl a, b, c, d;
+        memcpy(&a, x + i, sizeof(vdbl));
+        memcpy(&b, x + i + 4, sizeof(vdbl));
+        memcpy(&c, y + i, sizeof(vdbl));
+        memcpy(&d, y + i + 4, sizeof(vdbl));
+        acc0 += a * c;
+        acc1 += b * d;
+    }
+    acc0 += acc1;
+    double s = (acc0[0] + acc0[1]) + (acc0[2] + acc0[3]);
+    for(; i < n; i++)
+    {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+//Comparing vectors gives a mask with every bit set in the lanes where it's true, so pick lanes with that. n must be at least one.
+double kernel_min(double *x, int n)
+{
+    double m = x[0];
+    int i = 0;
+    if(n >= 4)
+    {
+        vdbl acc;
+        memcpy(&acc, x, sizeof(vdbl));
+        for(i = 4; i + 4 <= n; i += 4)
+        {
+            vdbl a;
+            memcpy(&a, x + i, sizeof(vdbl));
+            vmask lt = a < acc;
+            acc = (vdbl)(((vmask)a & lt) | ((vmask)acc & ~lt));
+        }
+        for(int j = 0; j < 4; j++)
+        {
+            m = acc[j] < m ? acc[j] : m;
+        }
+    }
+    for(; i < n; i++)
+    {
+        m = x[i] < m ? x[i] : m;
+    }
+    return m;
+}
+double kernel_max(double *x, int n)
+{
+    double m = x[0];
+    int i = 0;
+    if(n >= 4)
+    {
+        vdbl acc;
+        memcpy(&acc, x, sizeof(vdbl));
+        for(i = 4; i + 4 <= n; i += 4)
+        {
+            vdbl a;
+            memcpy(&a, x + i, sizeof(vdbl));
+            vmask gt = a > acc;
+            acc = (vdbl)(((vmask)a & gt) | ((vmask)acc & ~gt));
+        }
+        for(int j = 0; j < 4; j++)
+        {
+            m = acc[j] > m ? acc[j] : m;
+        }
+    }
+    for(; i < n; i++)
+    {
+        m = x[i] > m ? x[i] : m;
+    }
+    return m;
+}
+
+
+
+//Packed vectors
+//Turn a list of numbers into a vector. One float anywhere makes it a vector of doubles, otherwise the numbers have to fit in 64 bits.
+lval *lval_vec_from(char *func, lval *v)
+{
+    int bad = lval_non_number(v);
+    if(bad >= 0)
+    {
+        return lval_err("Function '%s' passed a list with a non-number in it. Got %s, expected %s. ",
+                func, ltype_name(LVAL_TYPE(v->cell[bad])), ltype_name(LVAL_NUM));
+    }
+    lval *x = lval_vec(v->count, lval_any_dbl(v));
+    for(int i = 0; i < v->count; i++)
+    {
+        if(x->is_dbl)
+        {
+            x->dbls[i] = lval_to_double(v->cell[i]);
+        }
+        else if(!lval_to_int64(v->cell[i], &x->ints[i]))
+        {
+            lval_del(x);
+            return lval_err("Function '%s' passed a number too big for a vector at position %i. ", func, i);
+        }
+    }
+    return x;
+}
+//Make sure argument i of a is a vector, converting a list of numbers in place. Hands back an error if it can't be done, NULL if all is well.
+lval *lval_vec_arg(char *func, lval *a, int i)
+{
+    switch(LVAL_TYPE(a->cell[i]))
+    {
+        case LVAL_VEC:
+            return NULL;
+        case LVAL_QEXPR:
+        {
+            lval *x = lval_vec_from(func, a->cell[i]);
+            if(x->type == LVAL_ERR)
+            {
+                return x;
+            }
+            lval_del(a->cell[i]);
+            a->cell[i] = x;
+            return NULL;
+        }
+        default:
+            return lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected %s. ",
+                    func, i, ltype_name(LVAL_TYPE(a->cell[i])), ltype_name(LVAL_VEC));
+    }
+}
+//Make vector argument i of a into doubles, if it isn't already. It's copied first if anyone else can see it.
+void lval_vec_to_dbl(lval *a, int i)
+{
+    if(a->cell[i]->is_dbl)
+    {
+        return;
+    }
+    lval *v = a->cell[i] = lval_own(a->cell[i]);
+    for(int j = 0; j < v->len; j++)
+    {
+        double x = (double)v->ints[j];
+        v->dbls[j] = x;
+    }
+    v->is_dbl = 1;
+}
+lval *builtin_vec(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec", a, 1);
+    LASSERT_VEC("vec", a, 0);
+    return lval_take(a, 0);
+}
+lval *builtin_vec_list(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec->list", a, 1);
+    LASSERT_TYPE("vec->list", a, 0, LVAL_VEC);
+
+    lval *v = a->cell[0];
+    lval *x = lval_qexpr();
+    lval_reserve(x, v->len);
+    for(int i = 0; i < v->len; i++)
+    {
+        x->cell[x->count++] = v->is_dbl ? lval_dbl(v->dbls[i]) : lval_num(v->ints[i]);
+    }
+    lval_del(a);
+    return x;
+}
+lval *builtin_vec_sum(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-sum", a, 1);
+    LASSERT_VEC("vec-sum", a, 0);
+
+    lval *v = a->cell[0];
+    lval *s = v->is_dbl ? lval_dbl(kernel_sum(v->dbls, v->len)) : lval_int128(kernel_sum_int(v->ints, v->len));
+    lval_del(a);
+    return s;
+}
+lval *builtin_vec_dot(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-dot", a, 2);
+    LASSERT_VEC("vec-dot", a, 0);
+    LASSERT_VEC("vec-dot", a, 1);
+    LASSERT(a, a->cell[0]->len == a->cell[1]->len,
+            "Function 'vec-dot' passed vectors of different lengths. Got %i and %i. ",
+            a->cell[0]->len, a->cell[1]->len);
+
+    if(a->cell[0]->is_dbl || a->cell[1]->is_dbl)
+    {
+        lval_vec_to_dbl(a, 0);
+        lval_vec_to_dbl(a, 1);
+        double s = kernel_dot(a->cell[0]->dbls, a->cell[1]->dbls, a->cell[0]->len);
+        lval_del(a);
+        return lval_dbl(s);
+    }
+
+    /* There's no multiplying 64 bit lanes into 128 bit answers with SIMD, so whole numbers go one at a time. Every product fits in 128 bits, but the sum of them mightn't, and then it's bignums for the rest, same as dot. */
+    int64_t *x = a->cell[0]->ints;
+    int64_t *y = a->cell[1]->ints;
+    int n = a->cell[0]->len;
+    __int128 s = 0;
+    int i = 0;
+    for(; i < n; i++)
+    {
+        __int128 t;
+        if(__builtin_add_overflow(s, (__int128)x[i] * y[i], &t))
+        {
+            break;
+        }
+        s = t;
+    }
+    lval *acc = lval_int128(s);
+    for(; i < n; i++)
+    {
+        acc = builtin_op(e, lval_add(lval_add(lval_sexpr(), acc), lval_int128((__int128)x[i] * y[i])), LOP_ADD);
+    }
+    lval_del(a);
+    return acc;
+}
+//Add a number to every element of a vector, or add two vectors element by element
+lval *builtin_vec_add(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-map+", a, 2);
+    LASSERT_VEC("vec-map+", a, 0);
+    int scalar = LVAL_NUMERIC(a->cell[1]);
+    if(!scalar)
+    {
+        LASSERT_VEC("vec-map+", a, 1);
+        LASSERT(a, a->cell[0]->len == a->cell[1]->len,
+                "Function 'vec-map+' passed vectors of different lengths. Got %i and %i. ",
+                a->cell[0]->len, a->cell[1]->len);
+    }
+
+    lval *x = a->cell[0];
+    lval *y = a->cell[1];
+    int dbl = x->is_dbl || (scalar ? LVAL_TYPE(y) == LVAL_DBL : y->is_dbl);
+    lval *z = lval_vec(x->len, dbl);
+    if(dbl)
+    {
+        lval_vec_to_dbl(a, 0);
+        x = a->cell[0];
+        if(scalar)
+        {
+            kernel_adds_dbl(z->dbls, x->dbls, lval_to_double(y), x->len);
+        }
+        else
+        {
+            lval_vec_to_dbl(a, 1);
+            kernel_add_dbl(z->dbls, x->dbls, a->cell[1]->dbls, x->len);
+        }
+        lval_del(a);
+        return z;
+    }
+
+    //Vectors can't hold bignums, so whole numbers that overflow are an error rather than a promotion
+    int64_t k = 0;
+    if(scalar && !lval_to_int64(y, &k))
+    {
+        lval_del(z);
+        lval_del(a);
+        return lval_err("Function 'vec-map+' passed a number too big for a vector. ");
+    }
+    if(scalar ? kernel_adds_int(z->ints, x->ints, k, x->len) : kernel_add_int(z->ints, x->ints, y->ints, x->len))
+    {
+        lval_del(z);
+        lval_del(a);
+        return lval_err("Function 'vec-map+' overflowed. The answer doesn't fit in a vector. ");
+    }
+    lval_del(a);
+    return z;
+}
+/* Sorting goes by radix rather than by comparing. Every element gets turned into an unsigned key that sorts the same way the number does: whole numbers just need their sign bit flipped, and doubles need every bit flipped if they're negative (bigger magnitude means smaller number) or just the sign bit if they're not. */
+lval *builtin_vec_sort(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-sort", a, 1);
+    LASSERT_VEC("vec-sort", a, 0);
+
+    lval *v = lval_own(lval_take(a, 0));
+    int n = v->len;
+    uint64_t sign = (uint64_t)1 << 63;
+    uint64_t *keys = malloc(sizeof(uint64_t) * (n ? n : 1));
+    memcpy(keys, v->ints, sizeof(uint64_t) * n);
+    for(int i = 0; i < n; i++)
+    {
+        keys[i] = !v->is_dbl ? keys[i] ^ sign : keys[i] & sign ? ~keys[i] : keys[i] | sign;
+    }
+    kernel_sort(keys, n);
+    for(int i = 0; i < n; i++)
+    {
+        keys[i] = !v->is_dbl ? keys[i] ^ sign : keys[i] & sign ? keys[i] ^ sign : ~keys[i];
+    }
+    memcpy(v->ints, keys, sizeof(uint64_t) * n);
+    free(keys);
+    return v;
+}
+//(vec-range start end) is every whole number from start up to, but not including, end. It goes straight into a vector without making a list first.
+lval *builtin_vec_range(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-range", a, 2);
+    LASSERT_TYPE("vec-range", a, 0, LVAL_NUM);
+    LASSERT_TYPE("vec-range", a, 1, LVAL_NUM);
+
+    int64_t lo, hi;
+    LASSERT(a, lval_to_int64(a->cell[0], &lo) && lval_to_int64(a->cell[1], &hi),
+            "Function 'vec-range' passed a number too big for a vector. ");
+    //Done unsigned, since the gap between two int64s mightn't fit in one
+    uint64_t n = hi > lo ? (uint64_t)hi - (uint64_t)lo : 0;
+    LASSERT(a, n <= INT_MAX,
+            "Function 'vec-range' asked for %llu numbers. A vector holds at most %i. ", (unsigned long long)n, INT_MAX);
+
+    lval *v = lval_vec((int)n, 0);
+    for(int i = 0; i < v->len; i++)
+    {
+        v->ints[i] = lo + i;
+    }
+    lval_del(a);
+    return v;
+}
+//(vec-fill n x) is a vector of n copies of x
+lval *builtin_vec_fill(lenv *e, lval *a)
+{
+    LASSERT_NUM("vec-fill", a, 2);
+    LASSERT_TYPE("vec-fill", a, 0, LVAL_NUM);
+    LASSERT_NUMBER("vec-fill", a, 1);
+
+    lval *n = a->cell[0];
+    LASSERT(a, LVAL_FIXNUM(n) && FIXNUM_VALUE(n) >= 0 && FIXNUM_VALUE(n) <= INT_MAX,
+            "Function 'vec-fill' passed a bad length. It has to be from 0 to %i. ", INT_MAX);
+    int64_t k = 0;
+    int dbl = LVAL_TYPE(a->cell[1]) == LVAL_DBL;
+    LASSERT(a, dbl || lval_to_int64(a->cell[1], &k),
+            "Function 'vec-fill' passed a number too big for a vector. ");
+
+    lval *v = lval_vec((int)FIXNUM_VALUE(n), dbl);
+    for(int i = 0; i < v->len; i++)
+    {
+        if(dbl) { v->dbls[i] = a->cell[1]->dbl; }
+        else    { v->ints[i] = k; }
+    }
+    lval_del(a);
+    return v;
+}
+
+
+
+/* Whole numbers add up exactly. Each one is split into its top 32 bits (signed) and its bottom 32 (unsigned), and those get added up in separate lanes: neither can overflow 64 bits in fewer than 2^31 elements, which is more than a vector can hold. The halves go back together in 128 bits at the end. */
+__int128 kernel_sum_int(int64_t *x, int n)
+{
+    vmask hi = { 0 };
+    vulong lo = { 0 };
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        vmask a;
+        memcpy(&a, x + i, sizeof(vmask));
+        hi += a >> 32;
+        lo += (vulong)a & 0xffffffff;
+    }
+    __int128 s = 0;
+    for(int j = 0; j < 4; j++)
+    {
+        s += (__int128)hi[j] * 4294967296 + lo[j];
+    }
+    for(; i < n; i++)
+    {
+        s += x[i];
+    }
+    return s;
+}
+/* Adding whole numbers in the lanes wraps around, so keep track of whether it ever did. A sum overflowed if both sides have the same sign and the answer has the other one, which shows up as the sign bit of (a^c)&(b^c). Returns 1 if anything overflowed. */
+int kernel_add_int(int64_t *z, int64_t *x, int64_t *y, int n)
+{
+    vulong over = { 0 };
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        vulong a, b;
+        memcpy(&a, x + i, sizeof(vulong));
+        memcpy(&b, y + i, sizeof(vulong));
+        vulong c = a + b;
+        over |= (a ^ c) & (b ^ c);
+        memcpy(z + i, &c, sizeof(vulong));
+    }
+    int overflowed = ((over[0] | over[1] | over[2] | over[3]) >> 63) != 0;
+    for(; i < n; i++)
+    {
+        overflowed |= __builtin_add_overflow(x[i], y[i], &z[i]);
+    }
+    return overflowed;
+}
+//Same thing with the same number added to everything
+int kernel_adds_int(int64_t *z, int64_t *x, int64_t y, int n)
+{
+    vulong over = { 0 };
+    vulong b = (vulong){ 0 } + (unsigned long long)y;
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        vulong a;
+        memcpy(&a, x + i, sizeof(vulong));
+        vulong c = a + b;
+        over |= (a ^ c) & (b ^ c);
+        memcpy(z + i, &c, sizeof(vulong));
+    }
+    int overflowed = ((over[0] | over[1] | over[2] | over[3]) >> 63) != 0;
+    for(; i < n; i++)
+    {
+        overflowed |= __builtin_add_overflow(x[i], y, &z[i]);
+    }
+    return overflowed;
+}
+void kernel_add_dbl(double *z, double *x, double *y, int n)
+{
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        vdbl a, b;
+        memcpy(&a, x + i, sizeof(vdbl));
+        memcpy(&b, y + i, sizeof(vdbl));
+        a += b;
+        memcpy(z + i, &a, sizeof(vdbl));
+    }
+    for(; i < n; i++)
+    {
+        z[i] = x[i] + y[i];
+    }
+}
+void kernel_adds_dbl(double *z, double *x, double y, int n)
+{
+    vdbl b = (vdbl){ 0 } + y;
+    int i = 0;
+    for(; i + 4 <= n; i += 4)
+    {
+        vdbl a;
+        memcpy(&a, x + i, sizeof(vdbl));
+        a += b;
+        memcpy(z + i, &a, sizeof(vdbl));
+    }
+    for(; i < n; i++)
+    {
+        z[i] = x[i] + y;
+    }
+}
+/* Least significant digit first radix sort, a byte at a time, so eight passes at most. All eight bytes get counted in one go up front, and a byte that's the same in every key doesn't need its pass, which for small numbers is most of them. Short vectors just get an insertion sort. */
+void kernel_sort(uint64_t *x, int n)
+{
+    if(n < 64)
+    {
+        for(int i = 1; i < n; i++)
+        {
+            uint64_t k = x[i];
+            int j = i;
+            for(; j > 0 && x[j-1] > k; j--)
+            {
+                x[j] = x[j-1];
+            }
+            x[j] = k;
+        }
+        return;
+    }
+
+    int (*counts)[256] = calloc(8, sizeof(*counts));
+    for(int i = 0; i < n; i++)
+    {
+        for(int d = 0; d < 8; d++)
+        {
+            counts[d][(x[i] >> (d * 8)) & 255]++;
+        }
+    }
+
+    uint64_t *from = x;
+    uint64_t *to = malloc(sizeof(uint64_t) * n);
+    for(int d = 0; d < 8; d++)
+    {
+        int *c = counts[d];
+        if(c[(from[0] >> (d * 8)) & 255] == n)
+        {
+            continue;
+        }
+        for(int b = 0, sum = 0; b < 256; b++)
+        {
+            int t = c[b];
+            c[b] = sum;
+            sum += t;
+        }
+        for(int i = 0; i < n; i++)
+        {
+            to[c[(from[i] >> (d * 8)) & 255]++] = from[i];
+        }
+        uint64_t *t = from;
+        from = to;
+        to = t;
+    }
+    //An odd number of passes leaves the answer in the spare buffer
+    if(from != x)
+    {
+        memcpy(x, from, sizeof(uint64_t) * n);
+        free(from);
+    }
+    else
+    {
+        free(to);
+    }
+    free(counts);
+}
+
+
+
+//Various built-ins
+//Built-in conditionals
+lval *builtin_if(lenv *e, lval *a)
+{
+    return lval_eval(e, builtin_if_branch(a));
+}
+//Same idea as builtin_eval_expr: pick the branch and hand it back as an S-Expression, or an error
+lval *builtin_if_branch(lval *a)
+{
+    LASSERT_NUM("if", a, 3);
+    LASSERT_TYPE("if", a, 0, LVAL_NUM);
+    LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
+    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
+
+    //The branches might be shared, so get our own copy of the one we want before turning it into an S-Expression
+    lval *x = lval_own(lval_pop(a, !LVAL_ZERO(a->cell[0]) ? 1 : 2));
+    x->type = LVAL_SEXPR;
+    lval_del(a);
+    return x;
+}
+//Load and parse a file instead of using a REPL the whole time
+lval *builtin_load(lenv *e, lval *a)
+{
+    //Only a load straight from main can stop to collect. Any other load is in the middle of evaluating something.
+    int top = gc.toplevel;
+    gc.toplevel = 0;
+
+    LASSERT_NUM("load", a, 1);
+    LASSERT_TYPE("load", a, 0, LVAL_STR);
+    
+    //Parse a file by a given string name
+    lval *expr = lval_parse_file(a->cell[0]->str);
+    if(LVAL_TYPE(expr) != LVAL_ERR)
+    {
+        //Evaluate each expression
+        if(top)
+        {
+            gc_push_root(a);
+            gc_push_root(expr);
+        }
+        for(int i = 0; i < expr->count; i++)
+        {
+            lval *x = lval_eval(e, lval_arg(expr, i));
+            //If evaluation leads to an error, print it. 
+            if(LVAL_TYPE(x) == LVAL_ERR)
+            {
+                lval_println(x);
+            }
+            lval_del(x);
+
+            if(top)
+            {
+                gc_safepoint();
+            }
+        }
+        if(top)
+        {
+            gc_pop_root();
+            gc_pop_root();
+        }
+        //Do some clean up
+        lval_del(expr);
+        lval_del(a);
+
+        //Return an empty list
+        return lval_sexpr();
+    }
+    else
+    {
+        //Create new error message from the parse error
+        lval *err = lval_err("Could not load library %s", expr->err);
+        lval_del(expr);
+        lval_del(a);
+
+        return err;
+    }
+}
+lval *builtin_print(lenv *e, lval *a)
+{
+    //Print each arg + ' '
+    for(int i = 0; i < a->count; i++)
+    {
+        lval_print(a->cell[i]); 
+        putchar(' ');
+    }
+    putchar('\n');
+    lval_del(a);
+    return lval_sexpr();
+}
+//Error handling!
+lval *builtin_error(lenv *e, lval *a)
+{
+    LASSERT_NUM("error", a, 1);
+    LASSERT_TYPE("error", a, 0, LVAL_STR);
+    //Construct the error from the first arg
+    lval *err = lval_err(a->cell[0]->str);
+    //Clean up
+    lval_del(a);
+    return err;
+}
+//Print some numbers about how the global environment's hash table is holding up. A one element S-Expression never calls anything, so use it like (env-stats ()).
+lval *builtin_env_stats(lenv *e, lval *a)
+{
+    LASSERT_NUM("env-stats", a, 1);
+
+    while(e->par)
+    {
+        e = e->par;
+    }
+
+    //How far each entry ended up from the slot it hashed to
+    long total = 0;
+    int longest = 0;
+    if(e->index)
+    {
+        for(int i = 0; i < e->slots; i++)
+        {
+            if(e->index[i])
             {
-                printf("\\ ");
-                lval_print(v->formals);
-                putchar(' ');
-                lval_print(v->body);
-                putchar(')');
+                int home = lenv_hash(e->syms[e->index[i]-1]) & (e->slots-1);
+                int probes = ((i - home) & (e->slots-1)) + 1;
+                total += probes;
+                if(probes > longest)
+                {
+                    longest = probes;
+                }
             }
-            break;
-        case LVAL_NUM:   printf("%li", v->num); break;
-        case LVAL_ERR:   printf("Error: %s", v->err); break;
-        case LVAL_SYM:   printf("%s", v->sym); break;
-        case LVAL_STR:   lval_print_str(v); break;
-        case LVAL_SEXPR: lval_print_expr(v, '(', ')'); break;
-        case LVAL_QEXPR: lval_print_expr('v', '{', '}'); break;
+        }
     }
+
+    printf("entries: %i, slots: %i, load factor: %.2f\n",
+            e->count, e->slots, e->slots ? (double)e->count / e->slots : 0.0);
+    printf("average probes: %.2f, longest probe: %i\n",
+            e->count && e->index ? (double)total / e->count : 0.0, longest);
+    printf("hashed lookups: %li, probes per lookup: %.2f\n",
+            lenv_stats.lookups, lenv_stats.lookups ? (double)lenv_stats.probes / lenv_stats.lookups : 0.0);
+
+    lval_del(a);
+    return lval_sexpr();
 }
-void lval_print_expr(lval *v, char open, char close)
+//Same deal for the garbage collector: (gc-stats ())
+lval *builtin_gc_stats(lenv *e, lval *a)
 {
-    putchar(open);
-    for(int i = 0; i < v->count; i++)
+    LASSERT_NUM("gc-stats", a, 1);
+
+    printf("collections: %li, bytes freed: %lu\n", gc.collections, (unsigned long)gc.freed);
+    printf("heap: %lu bytes, next collection at: %lu bytes\n", (unsigned long)gc.bytes, (unsigned long)gc.threshold);
+    printf("total pause: %.3f ms, longest pause: %.3f ms\n", gc.pause_total, gc.pause_max);
+
+    lval_del(a);
+    return lval_sexpr();
+}
+//Process for adding our built-in funcs
+void lenv_add_builtin(lenv *e, char *name, lbuiltin func)
+{
+    lenv_add_builtin_op(e, name, func, LOP_NONE);
+}
+//Same again for a builtin that has an opcode
+void lenv_add_builtin_op(lenv *e, char *name, lbuiltin func, int op)
+{
+    lval *k = lval_sym(name);
+    lval *v = lval_builtin(func, op);
+    lenv_put(e, k, v);
+    lval_del(k);
+    lval_del(v);
+}
+//Add all desired built-in functions to our language
+void lenv_add_builtins(lenv *e)
+{
+    //Variable funcs
+    lenv_add_builtin(e, "\\",  builtin_lambda);
+    lenv_add_builtin_op(e, "def", builtin_def, LOP_DEF);
+    lenv_add_builtin_op(e, "=",   builtin_put, LOP_PUT);
+
+    //List funcs
+    lenv_add_builtin(e, "list", builtin_list);
+    lenv_add_builtin(e, "head", builtin_head);
+    lenv_add_builtin(e, "tail", builtin_tail);
+    lenv_add_builtin(e, "eval", builtin_eval);
+    lenv_add_builtin(e, "join", builtin_join);
+
+    //Math operators
+    lenv_add_builtin_op(e, "+", builtin_add, LOP_ADD);
+    lenv_add_builtin_op(e, "-", builtin_sub, LOP_SUB);
+    lenv_add_builtin_op(e, "*", builtin_mul, LOP_MUL);
+    lenv_add_builtin_op(e, "/", builtin_div, LOP_DIV);
+    
+    //Comparison ops
+    lenv_add_builtin(e, "if", builtin_if);
+    lenv_add_builtin_op(e, "==", builtin_eq, LOP_EQ);
+    lenv_add_builtin_op(e, "!=", builtin_ne, LOP_NE);
+    lenv_add_builtin_op(e, ">",  builtin_gt, LOP_GT);
+    lenv_add_builtin_op(e, "<",  builtin_lt, LOP_LT);
+    lenv_add_builtin_op(e, ">=", builtin_ge, LOP_GE);
+    lenv_add_builtin_op(e, "<=", builtin_le, LOP_LE);
+
+    //Bulk numeric funcs
+    lenv_add_builtin(e, "sum", builtin_sum);
+    lenv_add_builtin(e, "dot", builtin_dot);
+    lenv_add_builtin(e, "min", builtin_min);
+    lenv_add_builtin(e, "max", builtin_max);
+
+    //Packed vector funcs
+    lenv_add_builtin(e, "vec",       builtin_vec);
+    lenv_add_builtin(e, "vec->list", builtin_vec_list);
+    lenv_add_builtin(e, "vec-sum",   builtin_vec_sum);
+    lenv_add_builtin(e, "vec-dot",   builtin_vec_dot);
+    lenv_add_builtin(e, "vec-map+",  builtin_vec_add);
+    lenv_add_builtin(e, "vec-sort",  builtin_vec_sort);
+    lenv_add_builtin(e, "vec-range", builtin_vec_range);
+    lenv_add_builtin(e, "vec-fill",  builtin_vec_fill);
+
+    //String funcs
+    lenv_add_builtin(e, "load",  builtin_load);
+    lenv_add_builtin(e, "error", builtin_error);
+    lenv_add_builtin(e, "print", builtin_print);
+
+    //Debugging
+    lenv_add_builtin(e, "env-stats", builtin_env_stats);
+    lenv_add_builtin(e, "gc-stats",  builtin_gc_stats);
+}
+
+
+
+//These functions are for evaluations.
+//Bind the n args to whichever formals of f are still unbound. The caller must own f, and the args are taken over. Returns NULL if all went well, an error otherwise.
+lval *lval_bind(lenv *e, lval *f, lval **args, int n)
+{
+    lval *formals = f->formals;
+    int total = formals->count - f->bound;
+
+    //Make room for every formal that's left in one go
+    lenv_grow(f->env, f->env->count + total);
+
+    for(int i = 0; i < n; i++)
     {
-        lval_print(v->cell[i]);
-        if(i != (v->count-1))
+        if(f->bound == formals->count)
         {
-            putchar(' ');
+            lval_del_args(&args[i], n - i);
+            return lval_err("Function passed too many arguments. " "Got %i, expected %i. ", n, total);
+        }
+        lval *sym = formals->cell[f->bound++];
+
+        if(sym->sym == sym_amp)
+        {
+            if(f->bound != formals->count - 1)
+            {
+                lval_del_args(&args[i], n - i);
+                return lval_err("Function format invalid. " "Symbol '&' not followed by single symbol. ");
+            }
+            //Everything that's left goes into one list
+            lval *rest = lval_qexpr();
+            rest->count = n - i;
+            rest->cap = rest->count;
+            rest->cell = malloc(sizeof(lval*) * rest->count);
+            memcpy(rest->cell, &args[i], sizeof(lval*) * rest->count);
+            gc.bytes += lval_payload(rest);
+            lenv_put(f->env, formals->cell[f->bound++], rest);
+            lval_del(rest);
+            break;
         }
+        lenv_put(f->env, sym, args[i]);
+        lval_del(args[i]);
     }
-    putchar(close);
+
+    if(f->bound < formals->count && formals->cell[f->bound]->sym == sym_amp)
+    {
+        if(f->bound != formals->count - 2)
+        {
+            return lval_err("Function format invalid. " "Symbol '&' not followed by single symbol. ");
+        }
+        lval *val = lval_qexpr();
+        lenv_put(f->env, formals->cell[f->bound+1], val);
+        lval_del(val);
+        f->bound = formals->count;
+    }
+    return NULL;
 }
-void lval_print_str(lval *v)
+//Let go of a run of args we're not going to use after all
+void lval_del_args(lval **args, int n)
 {
-    //Make a copy of the string
-    char *escaped = malloc(strlen(v->str)+1);
-    strcpy(escaped, v->str);
-    //Pass it through the escape function
-    escaped = mpcf_escape(escaped);
-    //Print it between double quotation characters
-    printf("\"%s\"", escaped);
-    //Clean up the copied string
-    free(escaped);
+    for(int i = 0; i < n; i++)
+    {
+        lval_del(args[i]);
+    }
 }
-void lval_println(lval *v)
+lval *lval_call(lenv *e, lval *f, lval *a)
 {
-    lval_print(v);
-    putchar('\n');
+    if(f->builtin)
+    {
+       return f->builtin(e, a);
+    }
+
+    lval *err = lval_bind(e, f, a->cell, a->count);
+    a->count = 0;
+    lval_del(a);
+    if(err)
+    {
+        return err;
+    }
+
+    if(f->bound == f->formals->count)
+    {
+        f->env->par = e;
+        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_ref(f->body)));
+    }
+    else
+    {
+        return lval_ref(f);
+    }
 }
+//S-expressions
+/* This goes around in a loop instead of recursing for anything in tail position: the body of a lambda, the branch an if picks, and whatever eval gets handed. That way a loop written as a tail call runs in the same bit of C stack however many times it goes around.
+   frame is the lambda whose env we're running in after a tail call. Scoping is dynamic, so the callee can still see the locals of the lambda it was called from, and its env has to hang off that lambda's env just like a normal call would. The one exception is when the callee binds every name the old env does (a loop calling itself, say): then the old env can never be seen again, so it gets freed and the callee hangs off its parent instead. That's what keeps a loop from piling up envs.
+   Old frames that can still be seen go in kept until we're done. */
+lval *lval_eval_sexpr(lenv *e, lval *v)
+{
+    lval *frame = NULL;
+    lval *kept = NULL;
+    while(1)
+    {
+        //A tail call can land on anything, and anything that isn't an S-Expression is a single step away
+        if(LVAL_TYPE(v) != LVAL_SEXPR)
+        {
+            v = lval_eval(e, v);
+            break;
+        }
 
+        //We're going to overwrite the cells, so this had better be ours
+        v = lval_own(v);
+        for(int i = 0; i < v->count; i++)
+        {
+            v->cell[i] = lval_eval(e, v->cell[i]);
+        }
+        int err = -1;
+        for(int i = 0; i < v->count; i++)
+        {
+            if(LVAL_TYPE(v->cell[i]) == LVAL_ERR)
+            {
+                err = i;
+                break;
+            }
+        }
+        if(err >= 0)
+        {
+            v = lval_take(v, err);
+            break;
+        }
+        
+        if(v->count == 0)
+        {
+            break;
+        }
+        if(v->count == 1)
+        {
+            v = lval_take(v, 0);
+            continue;
+        }
+
+        //Simple arithmetic gets done right here, without popping the function off or calling anything
+        lval *f = v->cell[0];
+        if(LVAL_TYPE(f) == LVAL_FUN && f->builtin && f->op)
+        {
+            lval *x = lop_fast(f->op, &v->cell[1], v->count-1);
+            if(x)
+            {
+                lval_del(v);
+                v = x;
+                break;
+            }
+        }
 
+        f = lval_pop(v, 0);
+        if(LVAL_TYPE(f) != LVAL_FUN)
+        {
+            lval *x = lval_err("S-Expression starts with incorrect type. " "Got %s, Expected %s. ", ltype_name(LVAL_TYPE(f)), ltype_name(LVAL_FUN));
+            lval_del(f);
+            lval_del(v);
+            v = x;
+            break;
+        }
 
-//Equality is a good thing. This is our version of affirmative action.
-int lval_eq(lval *x, lval *y)
-{
-    if(x->type != y->type)
+        //if and eval finish off with an evaluation, so do that one right here
+        if(f->builtin == builtin_if || f->builtin == builtin_eval)
+        {
+            v = f->builtin == builtin_if ? builtin_if_branch(v) : builtin_eval_expr(v);
+            lval_del(f);
+            continue;
+        }
+        if(f->builtin)
+        {
+            lval *x = f->builtin(e, v);
+            lval_del(f);
+            v = x;
+            break;
+        }
+
+        //Calling a lambda binds args into its env, so make sure nobody else can see that happen
+        f = lval_own(f);
+        lval *x = lval_bind(e, f, v->cell, v->count);
+        v->count = 0;
+        lval_del(v);
+        if(x)
+        {
+            lval_del(f);
+            v = x;
+            break;
+        }
+        //Not enough args yet, so the partially applied function is the result
+        if(f->bound < f->formals->count)
+        {
+            v = f;
+            break;
+        }
+
+        //Run the body in place of the frame we're leaving
+        if(frame && lenv_covers(f->env, frame->env))
+        {
+            f->env->par = frame->env->par;
+            lval_del(frame);
+        }
+        else
+        {
+            f->env->par = e;
+            if(frame)
+            {
+                kept = lval_add(kept ? kept : lval_qexpr(), frame);
+            }
+        }
+        frame = f;
+        e = f->env;
+        v = lval_own(lval_ref(f->body));
+        v->type = LVAL_SEXPR;
+    }
+    if(frame)
     {
-        return 0;
+        lval_del(frame);
     }
-    
-    //Basically just some type checking
-    switch(x->type)
+    if(kept)
     {
-        case LVAL_NUM: return(x->num == y->num);
-        case LVAL_ERR: return(strcmp(x->err, y->err) == 0);
-        case LVAL_SYM: return(strcmp(x->sym, y->sym) == 0);
-        case LVAL_STR: return(strcmp(x->str, y->str) == 0);
-        case LVAL_QEXPR:
-        case LVAL_SEXPR:
-                       if(x->count != y->count)
-                       {
-                           return 0;
-                       }
-                       for(int i = 0; i < x->count; i++)
-                       {
-                           if(!lval_eq(x->cell[i], y->cell[i]))
-                           {
-                               return 0;
-                           }
-                       }
-                       return 1;
-                       break;
+        lval_del(kept);
     }
-    return 0;
+    return v;
 }
 
 
 
-char *ltype_name(int t)
+
+//These functions are for the bytecode compiler.
+lcode *lcode_new(void)
 {
-    switch(t)
+    lcode *c = malloc(sizeof(lcode));
+    c->refs = 1;
+    c->count = 0;
+    c->cap = 0;
+    c->ops = NULL;
+    c->nconsts = 0;
+    c->consts = NULL;
+    c->nlocals = 0;
+    return c;
+}
+void lcode_del(lcode *c)
+{
+    //Somebody else is still running this code, so leave it be
+    if(--c->refs > 0)
     {
-        case LVAL_FUN:   return "Function";
-        case LVAL_NUM:   return "Number";
-        case LVAL_ERR:   return "Error";
-        case LVAL_SYM:   return "Symbol";
-        case LVAL_STR:   return "String";
-        case LVAL_SEXPR: return "S-Expression";
-        case LVAL_QEXPR: return "Q-Expression";
-        default:         return "Unknown";
+        return;
+    }
+    for(int i = 0; i < c->nconsts; i++)
+    {
+        lval_del(c->consts[i]);
+    }
+    free(c->consts);
+    free(c->ops);
+    free(c);
+}
+//Tack an int onto the end of the code and hand back where it went, which is handy for patching jumps later
+int lcode_emit(lcode *c, int op)
+{
+    if(c->count == c->cap)
+    {
+        c->cap = c->cap ? c->cap * 2 : 16;
+        c->ops = realloc(c->ops, sizeof(int) * c->cap);
     }
+    c->ops[c->count] = op;
+    return c->count++;
+}
+//The constants pool takes ownership of v
+int lcode_const(lcode *c, lval *v)
+{
+    c->nconsts++;
+    c->consts = realloc(c->consts, sizeof(lval*) * c->nconsts);
+    c->consts[c->nconsts-1] = v;
+    return c->nconsts-1;
 }
+//Work out which local slot a symbol lives in. Slots line up with the order lval_bind puts formals into the lambda's lenv.
+int lcode_slot(lval *formals, char *sym)
+{
+    if(!formals)
+    {
+        return -1;
+    }
 
+    int slot = 0;
+    for(int i = 0; i < formals->count; i++)
+    {
+        char *name = formals->cell[i]->sym;
+        if(name == sym_amp)
+        {
+            continue;
+        }
 
+        //A formal that shows up twice shares one lenv entry, so it only gets one slot too
+        int seen = 0;
+        for(int j = 0; j < i; j++)
+        {
+            if(formals->cell[j]->sym == name)
+            {
+                seen = 1;
+                break;
+            }
+        }
+        if(seen)
+        {
+            continue;
+        }
 
-//Create the Lisp environment
-lval *lenv_get(lenv *e, lval *k)
+        if(name == sym)
+        {
+            return slot;
+        }
+        slot++;
+    }
+    return -1;
+}
+//Compile a single expression so that running it leaves exactly one value on the stack. If tail is set, nothing in the lambda runs after it, so a call there can take over the lambda's frame.
+void lcode_expr(lcode *c, lval *formals, lval *v, int tail)
 {
-    for(int i = 0; i < e->count; i++)
+    switch(LVAL_TYPE(v))
     {
-        if(strcmp(e->syms[i], k->sym) == 0)
+        case LVAL_SYM:
         {
-            return lval_copy(e->vals[i]);
+            int slot = lcode_slot(formals, v->sym);
+            if(slot >= 0)
+            {
+                //The symbol rides along in case the slot somehow isn't there at run time
+                lcode_emit(c, OP_LOCAL);
+                lcode_emit(c, slot);
+                lcode_emit(c, lcode_const(c, lval_ref(v)));
+            }
+            else
+            {
+                lcode_emit(c, OP_LOOKUP);
+                lcode_emit(c, lcode_const(c, lval_ref(v)));
+            }
+            break;
         }
+        case LVAL_SEXPR:
+            lcode_sexpr(c, formals, v, tail);
+            break;
+        //Everything else evaluates to itself
+        default:
+            lcode_emit(c, OP_CONST);
+            lcode_emit(c, lcode_const(c, lval_ref(v)));
+            break;
+    }
+}
+//Compile v as if it were an S-Expression. This works for Q-Expression bodies too, since that's how eval treats them.
+void lcode_sexpr(lcode *c, lval *formals, lval *v, int tail)
+{
+    if(v->count == 0)
+    {
+        lcode_emit(c, OP_CONST);
+        lcode_emit(c, lcode_const(c, lval_sexpr()));
+        return;
+    }
+    if(v->count == 1)
+    {
+        lcode_expr(c, formals, v->cell[0], tail);
+        return;
     }
-    if(e->par)
+
+    /* 'if' with literal branches gets turned into jumps so the branches are compiled right along with everything else. Anything fancier (computed branches) just goes through builtin_if like normal.
+       Whether 'if' still means the builtin can't be known until it runs, since a formal or a def can take the name over at any time. So 'if' gets looked up like any other function, and OP_BRANCH only jumps if it finds builtin_if. Otherwise it falls back to an ordinary call with the branches as plain Q-Expressions. */
+    if(v->count == 4
+            && LVAL_TYPE(v->cell[0]) == LVAL_SYM && v->cell[0]->sym == sym_if
+            && LVAL_TYPE(v->cell[2]) == LVAL_QEXPR
+            && LVAL_TYPE(v->cell[3]) == LVAL_QEXPR)
     {
-        return lenv_get(e->par, k);
+        lcode_expr(c, formals, v->cell[0], 0);
+        lcode_expr(c, formals, v->cell[1], 0);
+        lcode_emit(c, OP_BRANCH);
+        int els = lcode_emit(c, 0);
+        int end = lcode_emit(c, 0);
+        int call = lcode_emit(c, 0);
+
+        lcode_sexpr(c, formals, v->cell[2], tail);
+        lcode_emit(c, OP_JUMP);
+        int skip = lcode_emit(c, 0);
+
+        c->ops[els] = c->count;
+        lcode_sexpr(c, formals, v->cell[3], tail);
+        lcode_emit(c, OP_JUMP);
+        int skip_call = lcode_emit(c, 0);
+
+        c->ops[call] = c->count;
+        lcode_expr(c, formals, v->cell[2], 0);
+        lcode_expr(c, formals, v->cell[3], 0);
+        lcode_emit(c, tail ? OP_TAILCALL : OP_CALL);
+        lcode_emit(c, 3);
+
+        c->ops[end] = c->count;
+        c->ops[skip] = c->count;
+        c->ops[skip_call] = c->count;
+        return;
     }
-    else
+
+    //Function first, then the args, then call it
+    for(int i = 0; i < v->count; i++)
     {
-        return lval_err("Unbound Symbol '%s'", k->sym);
+        lcode_expr(c, formals, v->cell[i], 0);
     }
+    lcode_emit(c, tail ? OP_TAILCALL : OP_CALL);
+    lcode_emit(c, v->count-1);
 }
-void lenv_put(lenv *e, lval *k, lval *v)
+lcode *lcode_compile(lval *v)
 {
-    for(int i = 0; i < e->count; i++)
-    {
-        if(strcmp(e->syms[i], k->sym) == 0)
-        {
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
-    }
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    lcode *c = lcode_new();
+    lcode_expr(c, NULL, v, 0);
+    lcode_emit(c, OP_RETURN);
+    return c;
 }
-void lenv_def(lenv *e, lval *k, lval *v)
+lcode *lcode_compile_lambda(lval *formals, lval *body)
 {
-    while(e->par)
+    lcode *c = lcode_new();
+    for(int i = 0; i < formals->count; i++)
     {
-        e = e->par;
+        if(lcode_slot(formals, formals->cell[i]->sym) >= c->nlocals)
+        {
+            c->nlocals++;
+        }
     }
-    lenv_put(e, k ,v);
+    lcode_sexpr(c, formals, body, 1);
+    lcode_emit(c, OP_RETURN);
+    return c;
 }
 
 
 
-//Prepare for built-ins. Lots and lots of built-ins.
-lval *lval_eval(lenv *e, lval *v)
+//These functions are for the virtual machine.
+typedef struct
+{
+    lcode *code;
+    int pc;
+    lenv *env;
+    //The lambda this frame is running. The frame owns it, and its env is where the locals live.
+    lval *f;
+    //Code compiled on the spot for an eval or if in tail position, which the frame owns too
+    lcode *tmp;
+    //Lambdas this frame tail called out of whose envs the current one can still see (see lval_eval_sexpr)
+    lval *kept;
+} lframe;
+
+//One value stack and one frame stack shared by every run, so builtins can safely call back into the VM
+struct
+{
+    int sp;
+    int cap;
+    lval **stack;
+
+    int fp;
+    int fcap;
+    lframe *frames;
+} vm;
+
+void vm_push(lval *x)
 {
-    if(v->type == LVAL_SYM)
+    if(vm.sp == vm.cap)
     {
-        lval *x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+        vm.cap = vm.cap ? vm.cap * 2 : 256;
+        vm.stack = realloc(vm.stack, sizeof(lval*) * vm.cap);
     }
-    if(v->type == LVAL_SEXPR)
+    vm.stack[vm.sp++] = x;
+}
+void vm_push_frame(lcode *c, lenv *e, lval *f)
+{
+    if(vm.fp == vm.fcap)
     {
-        return lval_eval_sexpr(e, v);
+        vm.fcap = vm.fcap ? vm.fcap * 2 : 64;
+        vm.frames = realloc(vm.frames, sizeof(lframe) * vm.fcap);
     }
-    return v;
+    lframe *fr = &vm.frames[vm.fp++];
+    fr->code = c;
+    fr->pc = 0;
+    fr->env = e;
+    fr->f = f;
+    fr->tmp = NULL;
+    fr->kept = NULL;
 }
+//Run c in e until the frame we started with returns. Lambdas called along the way get new frames instead of new C stack.
+lval *vm_run(lenv *e, lcode *c, lval *f)
+{
+    int entry = vm.fp;
+    vm_push_frame(c, e, f);
 
+    int pc = 0;
+    lenv *env = e;
+    int *ops = c->ops;
 
-
-//Gee, look at all these built-ins!
-//This function allows our users to utilize lambda expressions
-lval *builtin_lambda(lenv *e, lval *a)
+    while(1)
+    {
+        switch(ops[pc])
+        {
+            case OP_CONST:
+                vm_push(lval_ref(c->consts[ops[pc+1]]));
+                pc += 2;
+                break;
+            case OP_LOCAL:
+            {
+                int slot = ops[pc+1];
+                if(slot < env->count)
+                {
+                    vm_push(lval_ref(env->vals[slot]));
+                }
+                else
+                {
+                    vm_push(lenv_lookup(env, c->consts[ops[pc+2]]));
+                }
+                pc += 3;
+                break;
+            }
+            case OP_LOOKUP:
+                vm_push(lenv_lookup(env, c->consts[ops[pc+1]]));
+                pc += 2;
+                break;
+            case OP_JUMP:
+                pc = ops[pc+1];
+                break;
+            case OP_BRANCH:
+            {
+                //Somebody took the name 'if' for something else, so call whatever it is now
+                lval *f = vm.stack[vm.sp-2];
+                if(LVAL_TYPE(f) != LVAL_FUN || f->builtin != builtin_if)
+                {
+                    pc = ops[pc+3];
+                    break;
+                }
+                lval *x = vm.stack[vm.sp-1];
+                vm.stack[vm.sp-2] = x;
+                vm.sp--;
+                lval_del(f);
+                //Errors skip straight to the end of the if and become its value
+                if(LVAL_TYPE(x) == LVAL_ERR)
+                {
+                    pc = ops[pc+2];
+                    break;
+                }
+                if(LVAL_TYPE(x) != LVAL_NUM)
+                {
+                    vm.stack[vm.sp-1] = lval_err("Function '%s' passed incorrect type for argument %i. Got %s, expected %s. ",
+                            "if", 0, ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_NUM));
+                    lval_del(x);
+                    pc = ops[pc+2];
+                    break;
+                }
+                vm.sp--;
+                pc = !LVAL_ZERO(x) ? pc + 4 : ops[pc+1];
+                lval_del(x);
+                break;
+            }
+            case OP_CALL:
+            case OP_TAILCALL:
+            {
+                int tail = ops[pc] == OP_TAILCALL;
+                int n = ops[pc+1];
+                pc += 2;
+
+                vm.sp -= n + 1;
+                lval **items = &vm.stack[vm.sp];
+                lval *fn = items[0];
+
+                //Just like lval_eval_sexpr, the first error anywhere in the expression wins
+                lval *err = NULL;
+                for(int i = 0; i <= n; i++)
+                {
+                    if(LVAL_TYPE(items[i]) == LVAL_ERR)
+                    {
+                        err = items[i];
+                        break;
+                    }
+                }
+                if(err)
+                {
+                    for(int i = 0; i <= n; i++)
+                    {
+                        if(items[i] != err)
+                        {
+                            lval_del(items[i]);
+                        }
+                    }
+                    vm_push(err);
+                    break;
+                }
+                if(LVAL_TYPE(fn) != LVAL_FUN)
+                {
+                    err = lval_err("S-Expression starts with incorrect type. " "Got %s, Expected %s. ", ltype_name(LVAL_TYPE(fn)), ltype_name(LVAL_FUN));
+                    for(int i = 0; i <= n; i++)
+                    {
+                        lval_del(items[i]);
+                    }
+                    vm_push(err);
+                    break;
+                }
+
+                //Simple arithmetic never needs the args gathered up at all
+                if(fn->builtin && fn->op)
+                {
+                    lval *x = lop_fast(fn->op, &items[1], n);
+                    if(x)
+                    {
+                        lval_del_args(items, n+1);
+                        vm_push(x);
+                        break;
+                    }
+                }
+
+                lframe *fr = &vm.frames[vm.fp-1];
+                //Builtins want their args in an S-Expression, so gather them up off the stack
+                lval *a = NULL;
+                if(fn->builtin)
+                {
+                    a = lval_sexpr();
+                    a->count = n;
+                    a->cap = n;
+                    a->cell = malloc(sizeof(lval*) * n);
+                    memcpy(a->cell, &items[1], sizeof(lval*) * n);
+                    gc.bytes += lval_payload(a);
+                }
+
+                //In tail position, if and eval can run whatever they pick right here in this frame rather than in a whole new run of the VM
+                if(tail && fr->f && (fn->builtin == builtin_if || fn->builtin == builtin_eval))
+                {
+                    lval *x = fn->builtin == builtin_if ? builtin_if_branch(a) : builtin_eval_expr(a);
+                    lval_del(fn);
+                    if(LVAL_TYPE(x) == LVAL_ERR)
+                    {
+                        vm_push(x);
+                        break;
+                    }
+                    lcode *t = lcode_new();
+                    lcode_expr(t, NULL, x, 1);
+                    lcode_emit(t, OP_RETURN);
+                    lval_del(x);
+                    if(fr->tmp)
+                    {
+                        lcode_del(fr->tmp);
+                    }
+                    fr->tmp = t;
+                    fr->code = t;
+                    c = t;
+                    ops = t->ops;
+                    pc = 0;
+                    break;
+                }
+                if(fn->builtin)
+                {
+                    //Save our place first, builtins are allowed to run more code on this VM
+                    vm.frames[vm.fp-1].pc = pc;
+                    lval *x = fn->builtin(env, a);
+                    lval_del(fn);
+                    vm_push(x);
+                    break;
+                }
+
+                //Lambdas bind their args straight off the stack
+                fn = lval_own(fn);
+                err = lval_bind(env, fn, &items[1], n);
+                if(err)
+                {
+                    lval_del(fn);
+                    vm_push(err);
+                    break;
+                }
+                //Not enough args yet, so the partially applied function is the result
+                if(fn->bound < fn->formals->count)
+                {
+                    vm_push(fn);
+                    break;
+                }
+
+                fn->env->par = env;
+                if(!fn->code)
+                {
+                    vm.frames[vm.fp-1].pc = pc;
+                    lval *x = builtin_eval(fn->env, lval_add(lval_sexpr(), lval_ref(fn->body)));
+                    lval_del(fn);
+                    vm_push(x);
+                    break;
+                }
+
+                //A tail call takes over the frame it was made from, so loops don't pile up frames
+                fr = &vm.frames[vm.fp-1];
+                if(tail && fr->f)
+                {
+                    if(lenv_covers(fn->env, fr->env))
+                    {
+                        fn->env->par = fr->env->par;
+                        lval_del(fr->f);
+                    }
+                    else
+                    {
+                        fr->kept = lval_add(fr->kept ? fr->kept : lval_qexpr(), fr->f);
+                    }
+                    if(fr->tmp)
+                    {
+                        lcode_del(fr->tmp);
+                        fr->tmp = NULL;
+                    }
+                    fr->code = fn->code;
+                    fr->env = fn->env;
+                    fr->f = fn;
+                    fr->pc = 0;
+                }
+                //Otherwise step into the lambda
+                else
+                {
+                    fr->pc = pc;
+                    vm_push_frame(fn->code, fn->env, fn);
+                }
+                c = fn->code;
+                ops = c->ops;
+                env = fn->env;
+                pc = 0;
+                break;
+            }
+            case OP_RETURN:
+            {
+                lval *x = vm.stack[--vm.sp];
+                lframe *fr = &vm.frames[--vm.fp];
+                if(fr->f)
+                {
+                    lval_del(fr->f);
+                }
+                if(fr->tmp)
+                {
+                    lcode_del(fr->tmp);
+                }
+                if(fr->kept)
+                {
+                    lval_del(fr->kept);
+                }
+                if(vm.fp == entry)
+                {
+                    return x;
+                }
+                vm_push(x);
+
+                //Pick up where the caller left off
+                fr = &vm.frames[vm.fp-1];
+                c = fr->code;
+                ops = c->ops;
+                env = fr->env;
+                pc = fr->pc;
+                break;
+            }
+        }
+    }
+}
+//Compile and run a single expression
+lval *vm_eval(lenv *e, lval *v)
 {
-    LASSERT_NUM("\\", a, 2);
-    LASSERT_TYPE("\\", a, 0, LVAL_QEXPR);
-    LASSERT_TYPE("\\", a, 1, LVAL_QEXPR);
+    lcode *c = lcode_compile(v);
+    lval_del(v);
+    lval *x = vm_run(e, c, NULL);
+    lcode_del(c);
+    return x;
+}
 
-    for(int i = 0; i < a->cell[0]->count; i++)
+
+//These functions are for reading. Reading is good for you, don't you know?
+lval *lval_read_num(mpc_ast_t *t)
+{
+    //A point or an exponent makes it a float
+    if(strpbrk(t->contents, ".eE"))
     {
-        LASSERT(a, (a->cell[0]->cell[i]->type == LVAL_SYM),
-                "Cannot define non-symbol. Got %s, Expected %s. ",
-                ltype_name(a->cell[0]->cell[i]->type), ltype_name(lval_sym));
+        return lval_dbl(strtod(t->contents, NULL));
     }
-
-    lval *formals = lval_pop(a, 0);
-    lval *body = lval_pop(a , 0);
-    lval_del(a);
-    return lval_lambda(formals, body);
+    return lval_num_str(t->contents, strlen(t->contents));
 }
-//This one lets our users implement lists
-lval *builtin_list(lenv *e, lval *a)
+lval *lval_read_str(mpc_ast_t *t)
 {
-    a->type = LVAL_QEXPR;
-    return a;
+    //Trunc the trailing quote char
+    t->contents[strlen(t->contents)-1] = '\0';
+    //Copy the string minus the leading quote char
+    char *unescaped = malloc(strlen(t->contents+1)+1);
+    strcpy(unescaped, t->contents+1);
+    //Pass it through the unescape func
+    unescaped = mpcf_unescape(unescaped);
+    //Constrcut new lval using the string
+    lval *str = lval_str(unescaped);
+    //Clean up
+    free(unescaped);
+    return str;
 }
-//This builds-in the head function
-lval *builtin_head(lenv *e, lval *a)
+//The numbers in a vector literal get read like any others, and then packed the same way vec packs a list
+lval *lval_read_vec(mpc_ast_t *t)
 {
-    LASSERT_NUM("head", a, 1);
-    LASSERT_TYPE("head", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("head", a, 0);
+    lval *x = lval_qexpr();
+    for(int i = 0; i < t->children_num; i++)
+    {
+        if(strstr(t->children[i]->tag, "number"))
+        {
+            x = lval_add(x, lval_read_num(t->children[i]));
+        }
+    }
 
-    lval* v = lval_take(a, 0);
-    while(v->count > 1)
+    //One float makes them all doubles, and then anything fits. Otherwise a whole number too big for 64 bits is a syntax error, just like in lread_vec. Without a filename yet, lval_parsed puts that on the front.
+    if(!lval_any_dbl(x))
     {
-        lval_del(lval_pop(v, 1));
+        int64_t k;
+        for(int i = 0, j = 0; i < t->children_num; i++)
+        {
+            mpc_ast_t *c = t->children[i];
+            if(strstr(c->tag, "number") && !lval_to_int64(x->cell[j++], &k))
+            {
+                lval_del(x);
+                return lval_err("%li:%li: error: expected a number that fits in 64 bits at '%c'",
+                        c->state.row+1, c->state.col+1, c->contents[0]);
+            }
+        }
     }
+    lval *v = lval_vec_from("vec", x);
+    lval_del(x);
     return v;
 }
-//This implements the tail function
-lval *builtin_tail(lenv *e, lval *a)
+//Read input, call the proper functions. Pretty self-explanatory.
+lval *lval_read(mpc_ast_t *t)
 {
-    LASSERT_NUM("tail", a, 1);
-    LASSERT_TYPE("tail", a, 0, LVAL_QEXPR);
-    LASSERT_NOT_EMPTY("tail", a, 0);
+    if(strstr(t->tag, "vector")) { return lval_read_vec(t); }
+    if(strstr(t->tag, "number")) { return lval_read_num(t); }
+    if(strstr(t->tag, "string")) { return lval_read_str(t); }
+    if(strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
 
-    lval *v = lval_take(a, 0);
-    lval_del(lval_pop(v, 0));
-    return v;
+    lval *x = NULL;
+    if(strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
+    if(strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
+    if(strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
+
+    for(int i = 0; i < t->children_num; i++)
+    {
+        if(strcmp(t->children[i]->contents, "(") == 0) { continue; }
+        if(strcmp(t->children[i]->contents, ")") == 0) { continue; }
+        if(strcmp(t->children[i]->contents, "}") == 0) { continue; }
+        if(strcmp(t->children[i]->contents, "{") == 0) { continue; }
+        if(strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
+        if(strstr(t->children[i]->tag, "comment")) { continue; }
+        //The only thing that can go wrong in here is a vector literal, and that stops the whole read
+        lval *y = lval_read(t->children[i]);
+        if(LVAL_TYPE(y) == LVAL_ERR)
+        {
+            lval_del(x);
+            return y;
+        }
+        x = lval_add(x, y);
+    }
+    return x;
 }
-//This implements the eval ability
-lval *builtin_eval(lenv *e, lval *a)
+//Read every expression in input and hand them back in one S-Expression. Parse errors come back as an error. filename is only for the error messages.
+lval *lval_parse(char *filename, char *input)
 {
-    LASSERT_NUM("eval", a, 1);
-    LASSERT_TYPE("eval", a, 0, LVAL_QEXPR);
-
-    lval *x = lval_take(a, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+    if(!use_mpc)
+    {
+        return lread_input(filename, input);
+    }
+    mpc_result_t r;
+    int ok = mpc_parse(filename, input, Lispy, &r);
+    return lval_parsed(filename, ok, &r);
 }
-//This implements the join keyword
-lval *builtin_join(lenv *e, lval *a)
+//Same again, but for everything in the file called filename
+lval *lval_parse_file(char *filename)
 {
-    for(int i = 0; i < a->count; i++)
+    if(!use_mpc)
     {
-        LASSERT_TYPE("join", a, i, LVAL_QEXPR);
+        return lread_file(filename);
     }
-    lval *x = lval_pop(a, 0);
-    
-    while(a->count)
+    mpc_result_t r;
+    int ok = mpc_parse_contents(filename, Lispy, &r);
+    return lval_parsed(filename, ok, &r);
+}
+//Turn whatever mpc handed back into lvals, or into an error
+lval *lval_parsed(char *filename, int ok, mpc_result_t *r)
+{
+    if(!ok)
     {
-        lval* y = lval_pop(a, 0);
-        x = lval_join(x, y);
+        char *msg = mpc_err_string(r->error);
+        mpc_err_delete(r->error);
+        lval *err = lval_err("%s", msg);
+        free(msg);
+        return err;
+    }
+    lval *x = lval_read(r->output);
+    mpc_ast_delete(r->output);
+    if(LVAL_TYPE(x) == LVAL_ERR)
+    {
+        lval *err = lval_err("%s:%s", filename, x->err);
+        lval_del(x);
+        return err;
     }
-    lval_del(a);
     return x;
 }
-//Not-so-black ops! Just implementing built in mathematical operators
-lval *builtin_op(lenv *e, lval *a, char *op)
+//Slurp the whole file in and read it
+lval *lread_file(char *filename)
 {
-    for(int i = 0; i < a->count; i++)
+    FILE *f = fopen(filename, "rb");
+    if(!f)
     {
-        LASSERT_TYPE(op, a, i, LVAL_NUM);
+        return lval_err("%s: error: Unable to open file!", filename);
     }
-    lval *x = lval_pop(a, 0);
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
 
-    if((strcmp(op, "-") == 0) && a->count == 0)
+    char *input = malloc(size + 1);
+    size = fread(input, 1, size, f);
+    input[size] = '\0';
+    fclose(f);
+
+    lval *x = lread_input(filename, input);
+    free(input);
+    return x;
+}
+lval *lread_input(char *filename, char *input)
+{
+    lreader r = { filename, input, input, 0 };
+    lval *x = lval_sexpr();
+    while(1)
     {
-        //If subtraction is required, just do some unary negation
-        x->num = -x->num;
+        lread_skip(&r);
+        if(*r.s == '\0')
+        {
+            return x;
+        }
+        lval *y = lread_expr(&r);
+        if(r.failed)
+        {
+            lval_del(x);
+            return y;
+        }
+        x = lval_add(x, y);
     }
-    
-    while(a->count > 0)
+}
+//Whitespace and comments don't mean anything, so step over them
+void lread_skip(lreader *r)
+{
+    while(1)
     {
-        lval *y = lval_pop(a, 0);
-
-        if(strcmp(op, "+") == 0) { x->num += y->num; }
-        if(strcmp(op, "-") == 0) { x->num -= y->num; }
-        if(strcmp(op, "*") == 0) { x->num *= y->num; }
-        if(strcmp(op, "/") == 0) { 
-            if(y->num == 0)
+        if(isspace((unsigned char)*r->s))
+        {
+            r->s++;
+        }
+        else if(*r->s == ';')
+        {
+            while(*r->s && *r->s != '\r' && *r->s != '\n')
             {
-                lval_del(x);
-                lval_del(y);
-                x = lval_err("Division by zero. Not cool. ");
-                break;
+                r->s++;
             }
-            x->num /= y->num;
         }
-        lval_del(y);
+        else
+        {
+            return;
+        }
     }
-    return x;
 }
-
-
-
-//Add, subtract, multiply, divide. Handle these operators by calling their implementations.
-lval *builtin_add(lenv *e, lval *a) { return builtin_op(e, a, "+"); }
-lval *builtin_sub(lenv *e, lval *a) { return builtin_op(e, a, "-"); }
-lval *builtin_mul(lenv *e, lval *a) { return builtin_op(e, a, "*"); }
-lval *builtin_div(lenv *e, lval *a) { return builtin_op(e, a, "/"); }
-
-//Built-in variable controls PLUS error handling/reporting at NO EXTRA CHARGE!
-lval *builtin_var(lenv *e, lval *a, char *func)
+//Say where we got stuck, the same way mpc would
+lval *lread_error(lreader *r, char *expected)
 {
-    LASSERT_TYPE(func, a, 0, LVAL_QEXPR);
-
-    lval *syms = a->cell[0];
-    for(int i = 0; i < syms->count; i++)
+    r->failed = 1;
+    int line = 1;
+    int col = 1;
+    for(char *c = r->start; c < r->s; c++)
     {
-        LASSERT(a, (syms->cell[i]->type == LVAL_SYM),
-                "Function '%s' cannot define non-symbol. "
-                "Got %s, expected %s. ",
-                func, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+        if(*c == '\n') { line++; col = 1; }
+        else            { col++; }
     }
-
-    LASSERT(a, (syms->count == a->count-1),
-            "Function '%s' passed too many arguments for symbols. "
-            "Got %i, expected %i. ",
-            func, syms->count, a->count-1);
-
-    for(int i = 0; i < syms->count; i++)
+    if(*r->s == '\0')
     {
-        if(strcmp(func, "def") == 0) { lenv_def(e, syms->cell[i], a->cell[i+1]); }
-        if(strcmp(func, "=")   == 0) { lenv_put(e, syms->cell[i], a->cell[i+1]); }
+        return lval_err("%s:%i:%i: error: expected %s at end of input", r->name, line, col, expected);
     }
-    lval_del(a);
-    return lval_sexpr();
+    return lval_err("%s:%i:%i: error: expected %s at '%c'", r->name, line, col, expected, *r->s);
 }
-lval *builtin_def(lenv *e, lval *a) { return builtin_var(e, a, "def"); }
-lval *builtin_put(lenv *e, lval *a) { return builtin_var(e, a, "="); }
+//The characters a symbol can be made of
+#define LREAD_SYMBOL(c) (isalnum((unsigned char)(c)) || ((c) && strchr("_+-*/\\=<>!&", (c))))
 
-
-
-//Rules for comparison operators
-lval *builtin_ord(lenv *e, lval *a, char *op)
+lval *lread_expr(lreader *r)
 {
-    LASSERT_NUM(op, a, 2);
-    LASSERT_TYPE(op, a, 0, LVAL_NUM);
-    LASSERT_TYPE(op, a, 1, LVAL_NUM);
-
-    int r;
-    if(strcmp(op, ">")  == 0) { r = (a->cell[0]->num >  a->cell[1]->num); }
-    if(strcmp(op, "<")  == 0) { r = (a->cell[0]->num <  a->cell[1]->num); }   
-    if(strcmp(op, ">=") == 0) { r = (a->cell[0]->num >= a->cell[1]->num); }
-    if(strcmp(op, "<=") == 0) { r = (a->cell[0]->num <= a->cell[1]->num); }
-    
-    lval_del(a);
-    return lval_num(r);
-}
-//Deal with comparison operators by calling their implementations
-lval *builtin_gt(lenv *e, lval *a) { return builtin_ord(e, a, ">");   }
-lval *builtin_lt(lenv *e, lval *a) { return builtin_ord(e, a, "<");   }
-lval *builtin_ge(lenv *e, lval *a) { return builtin_ord(e, a, ">=");  }
-lval *builtin_le(lenv *e, lval *a) { return builtin_ord(e, a, "<=");  }
+    char c = *r->s;
 
+    //Lists
+    if(c == '(' || c == '{')
+    {
+        char close = c == '(' ? ')' : '}';
+        lval *x = c == '(' ? lval_sexpr() : lval_qexpr();
+        r->s++;
+        while(1)
+        {
+            lread_skip(r);
+            if(*r->s == close)
+            {
+                r->s++;
+                return x;
+            }
+            if(*r->s == '\0')
+            {
+                lval_del(x);
+                return lread_error(r, close == ')' ? "')'" : "'}'");
+            }
+            lval *y = lread_expr(r);
+            if(r->failed)
+            {
+                lval_del(x);
+                return y;
+            }
+            x = lval_add(x, y);
+        }
+    }
 
+    if(c == '"')
+    {
+        return lread_str(r);
+    }
 
-//Rulesets for == and !=
-lval *builtin_cmp(lenv *e, lval *a, char *op)
-{
-    LASSERT_NUM(op, a, 2);
-    int r;
-    if(strcmp(op, "==") == 0) { r =  lval_eq(a->cell[0], a->cell[1]); }
-    if(strcmp(op, "!=") == 0) { r = !lval_eq(a->cell[0], a->cell[1]); }
-    lval_del(a);
-    return lval_num(r);
-}
-//Handle == and != by calling their implementations
-lval *builtin_eq(lenv *e, lval *a) { return builtin_cmp(e, a, "=="); }
-lval *builtin_ne(lenv *e, lval *a) { return builtin_cmp(e, a, "!="); }
+    if(c == '#' && r->s[1] == '{')
+    {
+        return lread_vec(r);
+    }
 
+    //Numbers come first, just like in the grammar, so "-5" is a number but "-" and "-x" are symbols
+    int dbl;
+    char *p = lread_num(r->s, &dbl);
+    if(p)
+    {
+        char *start = r->s;
+        r->s = p;
+        return dbl ? lval_dbl(strtod(start, NULL)) : lval_num_str(start, p - start);
+    }
 
+    if(LREAD_SYMBOL(c))
+    {
+        char *start = r->s;
+        while(LREAD_SYMBOL(*r->s))
+        {
+            r->s++;
+        }
+        return lval_sym_len(start, r->s - start);
+    }
 
-//Various built-ins
-//Built-in conditionals
-lval *builtin_if(lenv *e, lval *a)
+    return lread_error(r, "one of number, symbol, string, comment, '(', '{' or '#{'");
+}
+//Where the number starting at s ends, or NULL if there isn't one there. dbl says whether it's a float.
+char *lread_num(char *s, int *dbl)
 {
-    LASSERT_NUM("if", a, 3);
-    LASSERT_TYPE("if", a, 0, LVAL_NUM);
-    LASSERT_TYPE("if", a, 1, LVAL_QEXPR);
-    LASSERT_TYPE("if", a, 2, LVAL_QEXPR);
-
-    lval *x;
-    a->cell[1]->type = LVAL_SEXPR;
-    a->cell[2]->type = LVAL_SEXPR;
+    char *p = s + (*s == '-');
+    if(!isdigit((unsigned char)*p))
+    {
+        return NULL;
+    }
+    while(isdigit((unsigned char)*p))
+    {
+        p++;
+    }
 
-    if(a->cell[0]->num)
+    //A point or an exponent makes it a float, but only with digits after it, just like the grammar. Otherwise the number stops short and whatever's left is a symbol.
+    *dbl = 0;
+    if(*p == '.' && isdigit((unsigned char)p[1]))
     {
-        x = lval_eval(e, lval_pop(a, 1));
+        for(p++; isdigit((unsigned char)*p); p++);
+        *dbl = 1;
     }
-    else
+    if(*p == 'e' || *p == 'E')
+    {
+        char *q = p + 1 + (p[1] == '+' || p[1] == '-');
+        if(isdigit((unsigned char)*q))
+        {
+            for(p = q; isdigit((unsigned char)*p); p++);
+            *dbl = 1;
+        }
+    }
+    return p;
+}
+/* Vector literals, the way vectors print. The numbers go straight into the vector without becoming lvals first. It takes two passes: the first counts them and sees whether there's a float among them, since one float makes the whole vector doubles, same as vec, and the second reads them in. */
+lval *lread_vec(lreader *r)
+{
+    char *start = r->s + 2;
+    int n = 0;
+    int any_dbl = 0;
+    r->s = start;
+    while(1)
     {
-        x = lval_eval(e, lval_pop(a, 2));
+        lread_skip(r);
+        if(*r->s == '}')
+        {
+            break;
+        }
+        int dbl;
+        char *p = lread_num(r->s, &dbl);
+        if(!p)
+        {
+            return lread_error(r, "a number or '}'");
+        }
+        any_dbl |= dbl;
+        n++;
+        r->s = p;
     }
 
-    lval_del(a);
-    return x;
+    lval *v = lval_vec(n, any_dbl);
+    r->s = start;
+    for(int i = 0; i < n; i++)
+    {
+        lread_skip(r);
+        int dbl;
+        char *p = lread_num(r->s, &dbl);
+        if(any_dbl)
+        {
+            v->dbls[i] = strtod(r->s, NULL);
+        }
+        else
+        {
+            errno = 0;
+            v->ints[i] = strtoll(r->s, NULL, 10);
+            if(errno == ERANGE)
+            {
+                lval_del(v);
+                return lread_error(r, "a number that fits in 64 bits");
+            }
+        }
+        r->s = p;
+    }
+    lread_skip(r);
+    r->s++;
+    return v;
 }
-//Load and parse a file instead of using a REPL the whole time
-lval *builtin_load(lenv *e, lval *a)
+//Strings get unescaped on the way in, with the same escapes mpc understands
+lval *lread_str(lreader *r)
 {
-    LASSERT_NUM("load", a, 1);
-    LASSERT_TYPE("load", a, 0, LVAL_STR);
-    
-    //Parse a file by a given string name
-    mpc_result_t r;
-    if(mpc_parse_contents(a->cell[0]->str, Lispy, &r))
+    char *start = r->s++;
+    char *p = r->s;
+    while(*p != '"')
     {
-        //Read the contents in
-        lval *expr = lval_read(r.output);
-        mpc_ast_delete(r.output);
+        if(*p == '\0')
+        {
+            r->s = start;
+            return lread_error(r, "a closing '\"'");
+        }
+        p += (*p == '\\' && p[1]) ? 2 : 1;
+    }
 
-        //Evaluate each expression
-        while(expr->count)
+    //Unescaping only ever makes things shorter, so this is plenty of room
+    char *buf = malloc(p - r->s + 1);
+    char *out = buf;
+    while(r->s < p)
+    {
+        char ch = *r->s++;
+        if(ch == '\\')
         {
-            lval *x = lval_eval(e, lval_pop(expr, 0));
-            //If evaluation leads to an error, print it. 
-            if(x->type == LVAL_ERR)
+            switch(*r->s)
             {
-                lval_println(x);
+                case 'a':  *out++ = '\a'; r->s++; continue;
+                case 'b':  *out++ = '\b'; r->s++; continue;
+                case 'f':  *out++ = '\f'; r->s++; continue;
+                case 'n':  *out++ = '\n'; r->s++; continue;
+                case 'r':  *out++ = '\r'; r->s++; continue;
+                case 't':  *out++ = '\t'; r->s++; continue;
+                case 'v':  *out++ = '\v'; r->s++; continue;
+                case '\\': *out++ = '\\'; r->s++; continue;
+                case '\'': *out++ = '\''; r->s++; continue;
+                case '"':  *out++ = '"';  r->s++; continue;
+                //A null can't live in a C string, so it just disappears
+                case '0':  r->s++; continue;
             }
-            lval_del(x);
         }
-        //Do some clean up
-        lval_del(expr);
-        lval_del(a);
+        *out++ = ch;
+    }
+    *out = '\0';
+    r->s = p + 1;
 
-        //Return an empty list
-        return lval_sexpr();
+    lval *x = lval_str(buf);
+    free(buf);
+    return x;
+}
+
+
+
+//These functions are for the garbage collector.
+#ifndef LISPY_MALLOC
+//One size class each for lvals and lenvs
+slab_class lval_slab = { .size = sizeof(lval) };
+slab_class lenv_slab = { .size = sizeof(lenv) };
+
+void *slab_alloc(slab_class *s)
+{
+    //Out of cells, so carve up a fresh block
+    if(!s->free)
+    {
+        char *block = malloc(s->size * SLAB_OBJECTS);
+        s->blocks = realloc(s->blocks, sizeof(void*) * (s->nblocks+1));
+        s->blocks[s->nblocks++] = block;
+        for(int i = SLAB_OBJECTS-1; i >= 0; i--)
+        {
+            slab_cell *c = (slab_cell*)(block + i * s->size);
+            c->next = s->free;
+            s->free = c;
+        }
     }
-    else
+    slab_cell *c = s->free;
+    s->free = c->next;
+    return c;
+}
+void slab_release(slab_class *s, void *p)
+{
+    slab_cell *c = p;
+    c->next = s->free;
+    s->free = c;
+}
+void slab_cleanup(slab_class *s)
+{
+    for(int i = 0; i < s->nblocks; i++)
     {
-        //Get parse error as string
-        char * err_msg = mpc_err_string(r.error);
-        mpc_err_delete(r.error);
+        free(s->blocks[i]);
+    }
+    free(s->blocks);
+    s->blocks = NULL;
+    s->nblocks = 0;
+    s->free = NULL;
+}
 
-        //Create new error message from that string
-        lval *err = lval_err("Could not load library %s", err_msg);
-        free(err_msg);
-        lval_del(a);
+#define LVAL_MALLOC()  slab_alloc(&lval_slab)
+#define LENV_MALLOC()  slab_alloc(&lenv_slab)
+#define LVAL_FREE(v)   slab_release(&lval_slab, v)
+#define LENV_FREE(e)   slab_release(&lenv_slab, e)
+#else
+#define LVAL_MALLOC()  malloc(sizeof(lval))
+#define LENV_MALLOC()  malloc(sizeof(lenv))
+#define LVAL_FREE(v)   free(v)
+#define LENV_FREE(e)   free(e)
+#endif
 
-        return err;
+//Every lval and lenv comes from here, so the collector can find them all later
+lval *lval_alloc(void)
+{
+    lval *v = LVAL_MALLOC();
+    v->mark = 0;
+    v->gc_prev = NULL;
+    v->gc_next = gc.lvals;
+    if(gc.lvals)
+    {
+        gc.lvals->gc_prev = v;
     }
+    gc.lvals = v;
+    gc.bytes += sizeof(lval);
+    return v;
 }
-lval *builtin_print(lenv *e, lval *a)
+lenv *lenv_alloc(void)
 {
-    //Print each arg + ' '
-    for(int i = 0; i < a->count; i++)
+    lenv *e = LENV_MALLOC();
+    e->mark = 0;
+    e->gc_prev = NULL;
+    e->gc_next = gc.lenvs;
+    if(gc.lenvs)
     {
-        lval_print(a->cell[i]); 
-        putchar(' ');
+        gc.lenvs->gc_prev = e;
     }
-    putchar('\n');
-    lval_del(a);
-    return lval_sexpr();
+    gc.lenvs = e;
+    gc.bytes += sizeof(lenv);
+    return e;
 }
-//Error handling!
-lval *builtin_error(lenv *e, lval *a)
+//And every one of them goes back through here, whether its refs ran out or the collector found it
+void lval_free(lval *v)
 {
-    LASSERT_NUM("error", a, 1);
-    LASSERT_TYPE("error", a, 0, LVAL_STR);
-    //Construct the error from the first arg
-    lval *err = lval_err(a->cell[0]->str);
-    //Clean up
-    lval_del(a);
-    return err;
+    if(v->gc_prev) { v->gc_prev->gc_next = v->gc_next; }
+    else           { gc.lvals = v->gc_next; }
+    if(v->gc_next) { v->gc_next->gc_prev = v->gc_prev; }
+    gc.bytes -= sizeof(lval);
+    LVAL_FREE(v);
 }
-//Process for adding our built-in funcs
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func)
+void lenv_free(lenv *e)
 {
-    lval *k = lval_sym(name);
-    lval *v = lval_builtin(func);
-    lenv_put(e, k, v);
-    lval_del(k);
-    lval_del(v);
+    if(e->gc_prev) { e->gc_prev->gc_next = e->gc_next; }
+    else           { gc.lenvs = e->gc_next; }
+    if(e->gc_next) { e->gc_next->gc_prev = e->gc_prev; }
+    gc.bytes -= sizeof(lenv);
+    LENV_FREE(e);
 }
-//Add all desired built-in functions to our language
-void lenv_add_builtins(lenv *e)
+//What v points at besides itself. It's counted when it's allocated and again when it's freed, so the collector sees a million element vector as more than one lval.
+size_t lval_payload(lval *v)
 {
-    //Variable funcs
-    lenv_add_builtin(e, "\\",  builtin_lambda);
-    lenv_add_builtin(e, "def", builtin_def);
-    lenv_add_builtin(e, "=",   builtin_put);
+    switch(v->type)
+    {
+        case LVAL_NUM: return sizeof(uint32_t) * v->big.len;
+        case LVAL_VEC: return sizeof(int64_t) * (v->len ? v->len : 1);
+        case LVAL_ERR: return strlen(v->err) + 1;
+        case LVAL_STR: return strlen(v->str) + 1;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR: return sizeof(lval*) * v->cap;
+    }
+    return 0;
+}
+size_t lenv_payload(lenv *e)
+{
+    return (sizeof(char*) + sizeof(lval*)) * e->cap + (e->index ? sizeof(int) * e->slots : 0);
+}
 
-    //List funcs
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
 
-    //Math operators
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul);
-    lenv_add_builtin(e, "/", builtin_div);
-    
-    //Comparison ops
-    lenv_add_builtin(e, "if", builtin_if);
-    lenv_add_builtin(e, "==", builtin_eq);
-    lenv_add_builtin(e, "!=", builtin_ne);
-    lenv_add_builtin(e, ">",  builtin_gt);
-    lenv_add_builtin(e, "<",  builtin_lt);
-    lenv_add_builtin(e, ">=", builtin_ge);
-    lenv_add_builtin(e, "<=", builtin_le);
 
-    //String funcs
-    lenv_add_builtin(e, "load",  builtin_load);
-    lenv_add_builtin(e, "error", builtin_error);
-    lenv_add_builtin(e, "print", builtin_print);
+//Values the top level is holding on to while it lets the collector run
+void gc_push_root(lval *v)
+{
+    if(gc.nroots == gc.rootcap)
+    {
+        gc.rootcap = gc.rootcap ? gc.rootcap * 2 : 16;
+        gc.roots = realloc(gc.roots, sizeof(lval*) * gc.rootcap);
+    }
+    gc.roots[gc.nroots++] = v;
+}
+void gc_pop_root(void)
+{
+    gc.nroots--;
 }
 
 
 
-//These functions are for evaluations.
-lval *lval_call(lenv *e, lval *f, lval *a)
+//Mark everything reachable from v
+void gc_mark_lval(lval *v)
 {
-    if(f->builtin)
+    if(LVAL_FIXNUM(v) || v->mark)
     {
-       return f->builtin(e, a);
+        return;
     }
-    
-    int given = a->count;
-    int total = f->formals->count;
+    v->mark = 1;
+    switch(v->type)
+    {
+        case LVAL_FUN:
+            if(!v->builtin)
+            {
+                gc_mark_lenv(v->env);
+                gc_mark_lval(v->formals);
+                gc_mark_lval(v->body);
+                if(v->code)
+                {
+                    for(int i = 0; i < v->code->nconsts; i++)
+                    {
+                        gc_mark_lval(v->code->consts[i]);
+                    }
+                }
+            }
+            break;
+        case LVAL_QEXPR:
+        case LVAL_SEXPR:
+            for(int i = 0; i < v->count; i++)
+            {
+                gc_mark_lval(v->cell[i]);
+            }
+            break;
+    }
+}
+//The parent isn't followed: it's only borrowed for the length of a call, so it may not even be there anymore
+void gc_mark_lenv(lenv *e)
+{
+    if(e->mark)
+    {
+        return;
+    }
+    e->mark = 1;
+    for(int i = 0; i < e->count; i++)
+    {
+        gc_mark_lval(e->vals[i]);
+    }
+    if(e->captured)
+    {
+        gc_mark_lval(e->captured);
+    }
+}
+
+
 
-    while(a->count)
+//Drop a dead object's reference to a live one, so the live one's count stays honest
+static void gc_release(lval *v)
+{
+    if(!LVAL_FIXNUM(v) && v->mark)
+    {
+        v->refs--;
+    }
+}
+/* Free everything that didn't get marked. Dead objects can point at each other in any order, so first let go of whatever live objects they point at, and only once that's done free them all without looking inside them again. */
+void gc_sweep(void)
+{
+    for(lval *v = gc.lvals; v; v = v->gc_next)
     {
-        if(f->formals->count == 0)
+        if(v->mark)
         {
-            lval_del(a);
-            return lval_err("Function passed too many arguments. " "Got %i, expected %i. ", given, total);
+            continue;
         }
-        lval *sym = lval_pop(f->formals, 0);
-
-        if(strcmp(sym->sym, "&") == 0)
+        switch(v->type)
         {
-            if(f->formals->count != 1)
-            {
-                lval_del(a);
-                return lval_err("Function format invalid. " "Symbol '&' not followed by single symbol. ");
-            }
-            lval *nsym = lval_pop(f->formals, 0);
-            lenv_put(f->env, nsym, builtin_list(e, a));
-            lval_del(sym);
-            lval_del(nsym);
-            break;
+            case LVAL_FUN:
+                if(!v->builtin)
+                {
+                    gc_release(v->formals);
+                    gc_release(v->body);
+                    //Code can be shared between copies of a lambda, so it goes when the last copy holding it does, dead or not
+                    if(v->code && --v->code->refs == 0)
+                    {
+                        for(int i = 0; i < v->code->nconsts; i++)
+                        {
+                            gc_release(v->code->consts[i]);
+                        }
+                        free(v->code->consts);
+                        free(v->code->ops);
+                        free(v->code);
+                    }
+                }
+                break;
+            case LVAL_QEXPR:
+            case LVAL_SEXPR:
+                for(int i = 0; i < v->count; i++)
+                {
+                    gc_release(v->cell[i]);
+                }
+                break;
         }
-        lval *val = lval_pop(a, 0);
-        lenv_put(f->env, sym, val);
-        lval_del(sym);
-        lval_del(val);
     }
-    lval_del(a);
-
-    if(f->formals->count > 0 && strcmp(f->formals->cell[0]->sym, "&") == 0)
+    for(lenv *e = gc.lenvs; e; e = e->gc_next)
     {
-        if(f->formals->count != 2)
+        if(!e->mark)
         {
-            return lval_err("Function format invalid. " "Symbol '&' not followed by single symbol. ");
+            for(int i = 0; i < e->count; i++)
+            {
+                gc_release(e->vals[i]);
+            }
+            if(e->captured)
+            {
+                gc_release(e->captured);
+            }
         }
-        lval_del(lval_pop(f->formals, 0));
-
-        lval *sym = lval_pop(f->formals, 0);
-        lval *val = lval_qexpr();
-        lenv_put(f->env, sym, val);
-        lval_del(sym);
-        lval_del(val);
     }
 
-    if(f->formals->count == 0)
+    //Now actually free them, clearing the marks on the survivors for next time
+    lval *v = gc.lvals;
+    while(v)
     {
-        f->env->par = e;
-        return builtin_eval(f->env, lval_add(lval_sexpr(), lval_copy(f->body)));
+        lval *next = v->gc_next;
+        if(v->mark)
+        {
+            v->mark = 0;
+        }
+        else
+        {
+            size_t n = lval_payload(v);
+            gc.bytes -= n;
+            gc.freed += sizeof(lval) + n;
+            switch(v->type)
+            {
+                case LVAL_NUM: free(v->big.d); break;
+                case LVAL_VEC: free(v->ints); break;
+                case LVAL_ERR: free(v->err); break;
+                case LVAL_STR: free(v->str); break;
+                case LVAL_QEXPR:
+                case LVAL_SEXPR: free(v->cell); break;
+            }
+            lval_free(v);
+        }
+        v = next;
     }
-    else
+    lenv *e = gc.lenvs;
+    while(e)
     {
-        return lval_copy(f);
+        lenv *next = e->gc_next;
+        if(e->mark)
+        {
+            e->mark = 0;
+        }
+        else
+        {
+            size_t n = lenv_payload(e);
+            gc.bytes -= n;
+            gc.freed += sizeof(lenv) + n;
+            for(int i = 0; i < e->count; i++)
+            {
+                SYM_INFO(e->syms[i])->locals--;
+            }
+            free(e->syms);
+            free(e->index);
+            lenv_free(e);
+        }
+        e = next;
     }
 }
-//S-expressions
-lval *lval_eval_sexpr(lenv *e, lval *v)
+void gc_collect(void)
 {
-    for(int i = 0; i < v->count; i++)
+    clock_t start = clock();
+
+    //Mark from the roots
+    gc_mark_lenv(lenv_global);
+    for(int i = 0; i < vm.sp; i++)
     {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+        gc_mark_lval(vm.stack[i]);
     }
-    for(int i = 0; i < v->count; i++)
+    for(int i = 0; i < vm.fp; i++)
     {
-        if(v->cell[i]->type == LVAL_ERR)
+        gc_mark_lenv(vm.frames[i].env);
+        if(vm.frames[i].f)
+        {
+            gc_mark_lval(vm.frames[i].f);
+        }
+        if(vm.frames[i].kept)
+        {
+            gc_mark_lval(vm.frames[i].kept);
+        }
+        for(int j = 0; j < vm.frames[i].code->nconsts; j++)
         {
-            return lval_take(v, i);
+            gc_mark_lval(vm.frames[i].code->consts[j]);
         }
     }
-    
-    if(v->count == 0)
+    for(int i = 0; i < gc.nroots; i++)
     {
-        return v;
+        gc_mark_lval(gc.roots[i]);
     }
-    if(v->count == 1)
+
+    gc_sweep();
+
+    //Let the heap grow in proportion to what survived
+    gc.threshold = gc.bytes * gc.growth;
+    if(gc.threshold < GC_INITIAL)
     {
-        return lval_eval(e, lval_take(v, 0));
+        gc.threshold = GC_INITIAL;
     }
 
-    lval *f = lval_pop(v, 0);
-    if(f->type != LVAL_FUN)
+    double pause = 1000.0 * (clock() - start) / CLOCKS_PER_SEC;
+    gc.collections++;
+    gc.pause_total += pause;
+    if(pause > gc.pause_max)
     {
-        lval *err = lval_err("S-Expression starts with incorrect type. " "Got %s, Expected %s. ", ltype_name(f->type), ltype_name(LVAL_FUN));
-        lval_del(f);
-        lval_del(v);
-        return err;
+        gc.pause_max = pause;
     }
-
-    lval *result = lval_call(e, f, v);
-    lval_del(f);
-    return result;
-}
-
-
-
-//These functions are for reading. Reading is good for you, don't you know?
-lval *lval_read_num(mpc_ast_t *t)
-{
-    errno = 0;
-    long x = strtol(t->contents, NULL, 10);
-    return errno != ERANGE ? lval_num(x) : lval_err("Invalid Number.");
-}
-lval *lval_read_str(mpc_ast_t *t)
-{
-    //Trunc the trailing quote char
-    t->contents[strlen(t->contents)-1] = '\0';
-    //Copy the string minus the leading quote char
-    char *unescaped = malloc(strlen(t->contents+1)+1);
-    strcpy(unescaped, t->contents+1);
-    //Pass it through the unescape func
-    unescaped = mpcf_unescape(unescaped);
-    //Constrcut new lval using the string
-    lval *str = lval_str(unescaped);
-    //Clean up
-    free(unescaped);
-    return str;
 }
-//Read input, call the proper functions. Pretty self-explanatory.
-lval *lval_read(mpc_ast_t *t)
+//Only ever call this where nothing but the roots is in flight
+void gc_safepoint(void)
 {
-    if(strstr(t->tag, "number")) { return lval_read_num(t); }
-    if(strstr(t->tag, "string")) { return lval_read_str(t); }
-    if(strstr(t->tag, "symbol")) { return lval_sym(t->contents); }
-
-    lval *x = NULL;
-    if(strcmp(t->tag, ">") == 0) { x = lval_sexpr(); }
-    if(strstr(t->tag, "sexpr"))  { x = lval_sexpr(); }
-    if(strstr(t->tag, "qexpr"))  { x = lval_qexpr(); }
-
-    for(int i = 0; i < t->children_num; i++)
+    if(gc.bytes >= gc.threshold)
     {
-        if(strcmp(t->children[i]->contents, "(") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, ")") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, "}") == 0) { continue; }
-        if(strcmp(t->children[i]->contents, "{") == 0) { continue; }
-        if(strcmp(t->children[i]->tag,  "regex") == 0) { continue; }
-        if(strstr(t->children[i]->tag, "comment")) { continue; }
-        x = lval_add(x, lval_read(t->children[i]));
+        gc_collect();
     }
-    return x;
+}
+//Hand the slabs back at exit. Whatever is still in them goes too, so only call this once nothing is left running.
+void gc_cleanup(void)
+{
+#ifndef LISPY_MALLOC
+    slab_cleanup(&lval_slab);
+    slab_cleanup(&lenv_slab);
+#endif
+    free(gc.roots);
 }